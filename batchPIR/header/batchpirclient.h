@@ -10,33 +10,61 @@ using namespace std;
 class BatchPIRClient
 {
 public:
+    // Everything the decode functions need from the last create_queries call. Saving and
+    // restoring it lets a client create the next batch before the previous one is answered.
+    struct QueryState
+    {
+        vector<uint64_t> cuckoo_table;
+        vector<uint64_t> cuckoo_keys;
+        vector<vector<uint64_t>> entry_slot_lists;
+    };
+
     BatchPIRClient() {};
     BatchPIRClient(const BatchPirParams &params);
-    void set_map(std::unordered_map<std::string, uint64_t> map);
-    vector<PIRQuery> create_queries(vector<uint64_t> batch);
-    vector<RawResponses> decode_responses(vector<PIRResponseList> responses);
-    vector<RawResponses> decode_responses_chunks(PIRResponseList responses);
+    void set_map(const std::unordered_map<std::string, uint64_t> &map);
+    void set_map(std::unordered_map<std::string, uint64_t> &&map);
+    const BatchPirParams &get_params() const;
+    // SEAL context shared by the sub-clients, needed to load serialized responses.
+    const seal::SEALContext &get_context() const;
+    QueryState get_query_state() const;
+    void set_query_state(QueryState state);
+    vector<PIRQuery> create_queries(const vector<uint64_t> &batch);
+    // Encrypt the randomness of num_batches future create_queries calls ahead of time,
+    // see Client::precompute_queries.
+    void precompute_queries(size_t num_batches);
+    size_t get_num_precomputed_queries() const;
+    vector<RawResponses> decode_responses(const vector<PIRResponseList> &responses);
+    vector<RawResponses> decode_responses_chunks(const PIRResponseList &responses);
+    vector<RawResponses> decode_compressed_responses(const CompressedResponseList &responses);
 
-    std::pair<seal::GaloisKeys, seal::RelinKeys> get_public_keys();
-    bool cuckoo_hash_witout_checks(vector<uint64_t> batch);
+    // The keys of the first sub-client cover all servers, copy them only to send them.
+    const ClientKeys &get_public_keys() const;
+    bool cuckoo_hash_witout_checks(const vector<uint64_t> &batch);
     vector<uint64_t> get_cuckoo_table();
+    // Database index held by each cuckoo bucket of the last batch, or the default value
+    // for empty buckets. The cuckoo table itself holds positions inside the buckets.
+    const vector<uint64_t> &get_cuckoo_keys() const;
     size_t get_serialized_commm_size();
 
 private:
     BatchPirParams batchpir_params_;
     size_t max_attempts_;
     vector<uint64_t> cuckoo_table_;
+    vector<uint64_t> cuckoo_keys_;
     bool is_cuckoo_generated_;
     bool is_map_set_;
     std::unordered_map<std::string, uint64_t> map_;
     vector<Client> client_list_;
+    CryptoContextPtr crypto_;
     size_t serialized_comm_size_ = 0;
 
-    void measure_size(vector<Ciphertext> list, size_t seeded = 1);
-    bool cuckoo_hash(vector<uint64_t> batch);
+    void measure_size(const vector<Ciphertext> &list, size_t seeded = 1);
+    // Decodes the (uncompressed) responses without adding them to the communication size.
+    vector<RawResponses> decode_chunks(const PIRResponseList &responses);
+    bool cuckoo_hash(const vector<uint64_t> &batch);
     void translate_cuckoo();
     void prepare_pir_clients();
-    bool cuckoo_insert(uint64_t key, size_t attempt, std::unordered_map<uint64_t, std::vector<size_t>> key_to_buckets, std::unordered_map<uint64_t, uint64_t> &bucket_to_key);
+    bool cuckoo_insert(uint64_t key, size_t attempt, const std::unordered_map<uint64_t, std::vector<size_t>> &key_to_buckets, std::unordered_map<uint64_t, uint64_t> &bucket_to_key);
 };
 
 #endif // BATCHPIRCLIENT_H
@@ -4,6 +4,9 @@
 #include <cstddef>
 #include <iomanip>
 #include <cstdlib>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 #include "database_constants.h"
 #include "utils.h"
 using namespace seal;
@@ -14,19 +17,37 @@ public:
     BatchPirParams() {};
     BatchPirParams(int batch_size, size_t num_entries, size_t entry_size, EncryptionParameters seal_params);
 
-    int get_num_hash_funcs();
-    int get_batch_size();
-    double get_cuckoo_factor();
-    size_t get_num_entries();
-    size_t get_entry_size();
-    size_t get_max_attempts();
-    size_t get_max_bucket_size();
-    size_t get_first_dimension_size();
-    uint64_t get_default_value();
-    uint32_t get_num_slots_per_entry();
-    seal::EncryptionParameters get_seal_parameters() const;
+    int get_num_hash_funcs() const;
+    int get_batch_size() const;
+    double get_cuckoo_factor() const;
+    size_t get_num_entries() const;
+    size_t get_entry_size() const;
+    size_t get_max_attempts() const;
+    size_t get_max_bucket_size() const;
+    size_t get_first_dimension_size() const;
+    uint64_t get_default_value() const;
+    uint32_t get_num_slots_per_entry() const;
+    const seal::EncryptionParameters &get_seal_parameters() const;
     void set_max_bucket_size(size_t max_bucket_size);
 
+    // Number of cuckoo buckets, ceil(cuckoo_factor * batch_size).
+    size_t get_total_buckets() const;
+    // Split the database into groups of entries_per_group consecutive entries and give
+    // every group a fixed, disjoint range of buckets. Entries of a group only hash to
+    // buckets of its range, so a batch that takes at most get_group_capacity(g) entries
+    // of every group g never overloads a range. 0 (the default) hashes every entry
+    // over all buckets.
+    void set_entries_per_group(size_t entries_per_group);
+    size_t get_entries_per_group() const;
+    size_t get_num_groups() const;
+    size_t get_group(uint64_t index) const;
+    // Buckets [first, second) of a group.
+    std::pair<size_t, size_t> get_group_buckets(size_t group) const;
+    // Entries of a group that one batch can hold at the cuckoo factor.
+    size_t get_group_capacity(size_t group) const;
+    // Buckets the entry with the given database index can be placed in.
+    std::vector<size_t> get_candidate_buckets(uint64_t index) const;
+
     void print_params() const;
 
 private:
@@ -38,6 +59,7 @@ private:
     size_t max_attempts_ = 0;
     size_t max_bucket_size_ = 0;
     size_t dim_size_ = 0;
+    size_t entries_per_group_ = 0;
     uint64_t default_value_ = DatabaseConstants::DefaultVal;
     seal::EncryptionParameters seal_params_;
 
@@ -10,22 +10,56 @@ class BatchPIRServer
 
 public:
     BatchPIRServer() {};
-    BatchPIRServer(BatchPirParams &batchpir_params);
+    BatchPIRServer(const BatchPirParams &batchpir_params);
     void setEntries(uint8_t *entries);
-    std::unordered_map<std::string, uint64_t> get_hash_map() const;
-    void set_client_keys(uint32_t client_id, std::pair<seal::GaloisKeys, seal::RelinKeys> keys);
+    // Parameters with the max bucket size found by setEntries, clients are built from these.
+    const BatchPirParams &get_params() const;
+    const std::unordered_map<std::string, uint64_t> &get_hash_map() const;
+    // SEAL context shared by the PIR servers, needed to load serialized queries and keys.
+    const seal::SEALContext &get_context() const;
+    // The keys are stored once and shared by all PIR servers.
+    void set_client_keys(uint32_t client_id, const ClientKeys &keys);
+    void set_client_keys(uint32_t client_id, ClientKeys &&keys);
     void get_client_keys();
-    PIRResponseList generate_response(uint32_t client_id, vector<PIRQuery> queries);
-    bool check_decoded_entries(vector<std::vector<std::vector<unsigned char>>> entries_list, vector<uint64_t> cuckoo_table);
+    PIRResponseList generate_response(uint32_t client_id, const vector<PIRQuery> &queries);
+    // Same as generate_response, but the responses are bit-packed for the wire.
+    CompressedResponseList generate_compressed_response(uint32_t client_id, const vector<PIRQuery> &queries);
+    // Answer requests of several clients concurrently with num_threads threads, the
+    // k'th response list answers queries[k] of client_ids[k]. The PIR servers are only
+    // read, so update_entries and set_client_keys must not run meanwhile. Every thread
+    // allocates from its own SEAL memory pool, if pool_alloc_bytes is given it receives
+    // the number of bytes these pools allocated.
+    vector<PIRResponseList> generate_responses(const vector<uint32_t> &client_ids, const vector<vector<PIRQuery>> &queries, size_t num_threads, size_t *pool_alloc_bytes = nullptr) const;
+    // Same, but every PIR server scans its database once for all requests, see
+    // Server::generate_responses. The PIR servers, then the merges of the clients, are
+    // spread over num_threads threads.
+    vector<PIRResponseList> generate_batched_responses(const vector<uint32_t> &client_ids, const vector<vector<PIRQuery>> &queries, size_t num_threads = 1, size_t *pool_alloc_bytes = nullptr) const;
+    void set_lazy_relinearization(bool lazy);
+    // Time in milliseconds of the first, second and last dimension summed over all
+    // servers, and of the response merge, for the last generate_response call.
+    std::array<double, 4> get_stage_times() const;
+    // Number of PIR servers the buckets are split over, each holds its own encoded database.
+    size_t get_num_servers() const;
+    bool check_decoded_entries(const vector<std::vector<std::vector<unsigned char>>> &entries_list, const vector<uint64_t> &cuckoo_table);
+
+    // Replace the given database entries (entry_size bytes each, in the order of
+    // indices) and re-encode only the PIR buckets that hold them. Returns the
+    // number of re-encoded plaintexts.
+    size_t update_entries(const std::vector<uint64_t> &indices, const uint8_t *entries);
 
 private:
-    BatchPirParams *batchpir_params_;
+    BatchPirParams batchpir_params_;
     RawDB rawdb_;
     vector<RawDB> buckets_;
     vector<Server> server_list_;
+    CryptoContextPtr crypto_;
     bool is_simple_hash_;
     bool is_client_keys_set_;
     std::unordered_map<std::string, uint64_t> map_; // map from key to bucket index
+    std::vector<uint32_t> entry_positions_; // entry_positions_[i * num_candidates + c] is the position of entry i in its c'th candidate bucket
+    size_t per_server_capacity_ = 0;
+    bool lazy_relin_ = false;
+    std::array<double, 4> stage_times_ = {0, 0, 0, 0};
 
     void simeple_hash();
     std::vector<std::vector<uint64_t>> simeple_hash_with_map();
@@ -36,7 +70,8 @@ private:
     std::size_t get_avg_bucket_size() const;
     void balance_buckets();
     size_t get_first_dimension_size(size_t num_entries);
-    PIRResponseList merge_responses(vector<PIRResponseList> &responses, uint32_t client_id);
+    PIRResponseList process_request(uint32_t client_id, const vector<PIRQuery> &queries, std::array<double, 4> &stage_times, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
+    PIRResponseList merge_responses(vector<PIRResponseList> &responses, uint32_t client_id, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
     void print_stats() const;
 };
 
@@ -6,39 +6,60 @@
 #include <vector>
 #include <algorithm>
 #include <bitset>
+#include <memory>
 #include "pirparams.h"
+#include "cryptocontext.h"
+#include "responsecodec.h"
 
 
 class Client {
 public:
-    // Constructor with pir_params
-    Client(PirParams& pir_params);
-    Client(PirParams &pir_params, seal::KeyGenerator* keygen);
+    // Constructor with pir_params. The SEAL context is shared if crypto is given.
+    Client(PirParams& pir_params, CryptoContextPtr crypto = CryptoContextPtr());
+    // Shares the key generator, and therefore the public keys, of another client.
+    // No keys are generated, get_public_keys() must be called on the owning client.
+    Client(PirParams &pir_params, std::shared_ptr<seal::KeyGenerator> keygen, CryptoContextPtr crypto = CryptoContextPtr());
 
     // Public member functions
 
-    std::pair<seal::GaloisKeys, seal::RelinKeys> get_public_keys();
+    const ClientKeys &get_public_keys() const;
     PIRQuery gen_query(uint64_t index);
-    PIRQuery gen_query(vector<uint64_t> indices);
-    seal::KeyGenerator* get_keygen();
-    vector<uint64_t> get_entry_list();
-    std::vector<unsigned char> decode_response(PIRResponseList response);
-    RawResponses decode_responses(PIRResponseList response);
-    std::vector<std::vector<unsigned char>> single_pir_decode_responses(PIRResponseList response);
-    RawResponses decode_responses_chunks(PIRResponseList response);
-    vector<RawResponses> decode_merged_responses(PIRResponseList response, size_t cuckoo_size,vector<vector<uint64_t>> entry_slot_lists);
+    PIRQuery gen_query(const vector<uint64_t> &indices);
+    // Offline phase: encrypt zeros for num_queries future queries. A query made
+    // afterwards only encodes its selection vectors and adds them to the stored
+    // encryptions. Every encryption is used once, queries fall back to encrypting
+    // online when none are left.
+    void precompute_queries(size_t num_queries);
+    size_t get_num_precomputed_queries() const;
+    std::shared_ptr<seal::KeyGenerator> get_keygen();
+    const vector<uint64_t> &get_entry_list() const;
+    // Restore the entry slots of an earlier gen_query call before decoding its responses.
+    void set_entry_list(vector<uint64_t> entry_slot_list);
+    std::vector<unsigned char> decode_response(const PIRResponseList &response);
+    PIRResponseList decompress_responses(const CompressedResponseList &responses) const;
+    RawResponses decode_responses(const PIRResponseList &response);
+    // Decode the responses in [begin, end) of a longer list without copying them out.
+    RawResponses decode_responses(PIRResponseList::const_iterator begin, PIRResponseList::const_iterator end);
+    std::vector<std::vector<unsigned char>> single_pir_decode_responses(const PIRResponseList &response);
+    RawResponses decode_responses_chunks(const PIRResponseList &response);
+    vector<RawResponses> decode_merged_responses(const PIRResponseList &response, size_t cuckoo_size, const vector<vector<uint64_t>> &entry_slot_lists);
 
 private:
     // Private member variables
     PirParams pir_params_;
-    seal::SEALContext* context_;
-    seal::KeyGenerator* keygen_;
+    CryptoContextPtr crypto_;
+    // owned by crypto_
+    const seal::SEALContext* context_;
+    const seal::BatchEncoder* batch_encoder_;
+    const seal::Evaluator* evaluator_;
+    std::shared_ptr<seal::KeyGenerator> keygen_;
     seal::SecretKey secret_key_;
-    seal::Encryptor* encryptor_;
-    seal::Decryptor* decryptor_;
-    seal::BatchEncoder* batch_encoder_;
-    seal::GaloisKeys gal_keys_;
-    seal::RelinKeys relin_keys_;
+    std::shared_ptr<seal::Encryptor> encryptor_;
+    std::shared_ptr<seal::Decryptor> decryptor_;
+    ResponseCodec response_codec_;
+    // fresh encryptions of zero, consumed from the back
+    std::vector<seal::Ciphertext> precomputed_zeros_;
+    ClientKeys public_keys_;
 
     size_t plaint_bit_count_;
     size_t polynomial_degree_;
@@ -51,8 +72,10 @@ private:
 
     // Private member functions
     std::vector<size_t> compute_indices(uint64_t desired_index);
-    std::vector<unsigned char> convert_to_rawdb_entry(std::vector<uint64_t>  input_list);
+    std::vector<unsigned char> convert_to_rawdb_entry(const std::vector<uint64_t> &input_list);
+    // plain_queries is consumed, pass it with std::move
     PIRQuery merge_pir_queries(vector<PirDB> plain_queries);
+    void encrypt_query_part(const seal::Plaintext &pt, seal::Ciphertext &destination);
     void check_noise_budget(const seal::Ciphertext& response); 
 };
 
@@ -0,0 +1,35 @@
+#ifndef CRYPTO_CONTEXT_H
+#define CRYPTO_CONTEXT_H
+
+#include <memory>
+#include "seal/seal.h"
+
+// SEAL objects that only depend on the encryption parameters. Creating a SEALContext
+// precomputes the NTT tables and Galois tools of every level, so the sub-servers of a
+// BatchPIRServer (and the sub-clients of a BatchPIRClient) share one instance.
+class CryptoContext
+{
+public:
+    explicit CryptoContext(const seal::EncryptionParameters &seal_params);
+
+    const seal::SEALContext &get_context() const;
+    const seal::Evaluator &get_evaluator() const;
+    const seal::BatchEncoder &get_batch_encoder() const;
+
+private:
+    seal::SEALContext context_;
+    seal::Evaluator evaluator_;
+    seal::BatchEncoder batch_encoder_;
+
+    CryptoContext(const CryptoContext &) = delete;
+    CryptoContext &operator=(const CryptoContext &) = delete;
+};
+
+typedef std::shared_ptr<const CryptoContext> CryptoContextPtr;
+
+inline CryptoContextPtr make_crypto_context(const seal::EncryptionParameters &seal_params)
+{
+    return std::make_shared<const CryptoContext>(seal_params);
+}
+
+#endif // CRYPTO_CONTEXT_H
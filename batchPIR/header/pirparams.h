@@ -23,8 +23,10 @@ public:
     vector<size_t>  get_dimensions() const;
     size_t  get_max_db_count() const;
     size_t  get_db_count() const;
-    seal::EncryptionParameters get_seal_parameters() const;
+    const seal::EncryptionParameters &get_seal_parameters() const;
     uint64_t get_default_value() const;
+    // Galois key steps, +-gap * 2^j, from which SEAL composes every rotation the server applies.
+    vector<int> get_rotation_steps() const;
     void print_values();
     
 
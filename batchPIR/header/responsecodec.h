@@ -0,0 +1,68 @@
+#ifndef RESPONSE_CODEC_H
+#define RESPONSE_CODEC_H
+
+#include <cstdint>
+#include <vector>
+#include "seal/seal.h"
+
+using namespace std;
+
+typedef vector<uint8_t> CompressedResponse;
+typedef vector<CompressedResponse> CompressedResponseList;
+
+// Compact wire format for PIR responses.
+//
+// The server switches each response down to the lowest level whose modulus switching
+// noise is provably small, and the codec then rounds away the low-order bits of both
+// ciphertext polynomials and bit-packs what is left. Both sides derive the same layout
+// from the SEAL context, so the payload is just a level byte followed by the packed
+// coefficients.
+//
+// All bounds are worst case (|s|_1 <= N). The rounding added by switching and by
+// dropping bits together stays below 2^-(noise_margin_bits + 1) of the decryption
+// threshold, so a response that decrypts with a noise budget above that margin still
+// decrypts after compression.
+class ResponseCodec
+{
+public:
+    ResponseCodec() {}
+    ResponseCodec(const seal::SEALContext &context, size_t noise_margin_bits = 4);
+
+    // switch ct down to the response level, if it is not already lower
+    void mod_switch(const seal::Evaluator &evaluator, seal::Ciphertext &ct, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
+
+    CompressedResponse compress(const seal::Ciphertext &ct) const;
+    seal::Ciphertext decompress(const CompressedResponse &data) const;
+
+    // compressed size in bytes of a ciphertext at the response level
+    size_t compressed_size() const;
+
+    seal::parms_id_type get_response_parms_id() const;
+
+private:
+    struct Layout
+    {
+        seal::parms_id_type parms_id;
+        vector<uint64_t> primes;
+        // if composed, the coefficient is reconstructed from its residues (at most two
+        // primes) and the low dropped_bits[poly] bits are rounded away. Otherwise every
+        // residue is stored as is.
+        bool composed = false;
+        size_t dropped_bits[2] = {0, 0};
+        size_t widths[2] = {0, 0};
+        vector<size_t> residue_widths;
+        uint64_t q0_inv_mod_q1 = 0;
+
+        size_t coeff_bits(size_t poly) const;
+    };
+
+    const seal::SEALContext *context_ = nullptr;
+    size_t poly_degree_ = 0;
+    size_t response_chain_index_ = 0;
+    // indexed by chain index
+    vector<Layout> layouts_;
+
+    const Layout &layout_of(size_t chain_index) const;
+};
+
+#endif // RESPONSE_CODEC_H
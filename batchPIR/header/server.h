@@ -6,16 +6,42 @@
 #include <iostream>
 #include <chrono>
 #include <bitset>
+#include <array>
+#include <set>
 #include "pirparams.h"
+#include "cryptocontext.h"
+#include "responsecodec.h"
 
 using namespace seal;
 using namespace utils;
 
+// State of a single generate_response call: the query, the client's keys, scratch
+// buffers and the stage timings. The
+// encoded database is only read, so with one context per request a Server can answer
+// several requests at the same time.
+struct RequestContext
+{
+    uint32_t client_id = 0;
+    // not copied, must outlive the request
+    const PIRQuery *query = nullptr;
+    const seal::GaloisKeys *galois_keys = nullptr;
+    const seal::RelinKeys *relin_keys = nullptr;
+    // every SEAL call and every ciphertext of the request allocates from this pool, give
+    // each thread its own pool so that allocations do not contend on the global one
+    seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool();
+    // accumulator of the first dimension, one per ciphertext polynomial
+    std::vector<std::vector<__uint128_t>> product_buffer;
+    // time in milliseconds spent in the first, second and last dimension
+    std::array<double, 3> stage_times = {{0, 0, 0}};
+};
+
 class Server {
 public:
     // Constructor and destructor
-    Server(PirParams &pir_params);
-    Server(PirParams &pir_params, vector<RawDB> sub_buckets);
+    // The SEAL context is shared with other servers using the same parameters if crypto
+    // is given, otherwise the server creates its own.
+    Server(PirParams &pir_params, CryptoContextPtr crypto = CryptoContextPtr());
+    Server(PirParams &pir_params, vector<RawDB> &&sub_buckets, CryptoContextPtr crypto = CryptoContextPtr());
 
     // Creating raw database only used when server is initialized independently
     void populate_raw_db();
@@ -28,27 +54,54 @@ public:
 
     void ntt_preprocess_db();
 
-    void set_client_keys(uint32_t client_id, std::pair<seal::GaloisKeys, seal::RelinKeys>);
-    void set_client_keys(uint32_t client_id, std::pair<seal::GaloisKeys, seal::RelinKeys> keys, uint64_t id);
-    void get_client_keys();
-
-    PIRResponseList generate_response(uint32_t client_id, PIRQuery query);
+    // Replace entry entry_indices[k] of database db_indices[k] with entries[k]
+    // and re-encode only the plaintexts that hold the changed entries.
+    // Returns the number of plaintexts that were re-encoded.
+    size_t update_entries(const vector<size_t> &db_indices, const vector<size_t> &entry_indices, const RawDB &entries);
 
-    bool check_decoded_entry( std::vector<unsigned char> entry, int index);
-    bool check_decoded_entries(std::vector<std::vector<unsigned char>> entries, vector<uint64_t> indices);
+    void set_client_keys(uint32_t client_id, const ClientKeys &keys);
+    void set_client_keys(uint32_t client_id, ClientKeys &&keys);
+    // share the keys with other servers instead of copying them
+    void set_client_keys(uint32_t client_id, ClientKeysPtr keys);
+    void get_client_keys();
 
-    PIRResponseList merge_responses_chunks_buckets(vector<PIRResponseList>& responses, uint32_t client_id);
-    PIRResponseList merge_responses_buckets_chunks(vector<PIRResponseList>& responses, uint32_t client_id);
+    PIRResponseList generate_response(uint32_t client_id, const PIRQuery &query);
+    // Reentrant variant, safe to call concurrently for different requests as long as
+    // the database and the client keys are not modified meanwhile.
+    RequestContext make_request_context(uint32_t client_id, const PIRQuery &query, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
+    RequestContext make_request_context(uint32_t client_id, PIRQuery &&query, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const = delete;
+    PIRResponseList generate_response(RequestContext &request) const;
+    // Answer several requests with a single pass over the database. The first dimension
+    // walks encoded_db_ in cache sized tiles and multiplies each tile with the rotated
+    // queries of all requests before moving on, the other dimensions run per request.
+    // Every request reports the time of the shared first dimension pass.
+    vector<PIRResponseList> generate_responses(vector<RequestContext> &requests) const;
+    // Bit-pack (merged) responses with the response codec, see ResponseCodec.
+    CompressedResponseList compress_responses(const PIRResponseList &responses) const;
+
+    // When enabled, the second dimension accumulates unrelinearized products and
+    // relinearizes once per output instead of once per term.
+    void set_lazy_relinearization(bool lazy);
+    // Time in milliseconds spent in the first, second and last dimension by the last generate_response call.
+    std::array<double, 3> get_stage_times() const;
+
+    bool check_decoded_entry(const std::vector<unsigned char> &entry, int index);
+    bool check_decoded_entries(const std::vector<std::vector<unsigned char>> &entries, const vector<uint64_t> &indices);
+
+    PIRResponseList merge_responses_chunks_buckets(vector<PIRResponseList>& responses, uint32_t client_id, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
+    PIRResponseList merge_responses_buckets_chunks(vector<PIRResponseList>& responses, uint32_t client_id, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
 
 
 private:
     // Private member variables
     PirParams pir_params_;
-    seal::SEALContext *context_;
-    seal::Evaluator *evaluator_;
-    seal::BatchEncoder *batch_encoder_;
-    std::map<uint32_t, std::pair<seal::GaloisKeys, seal::RelinKeys>> client_keys_;
-    vector<std::pair<seal::GaloisKeys, seal::RelinKeys>> client_keys_2;
+    CryptoContextPtr crypto_;
+    // owned by crypto_
+    const seal::SEALContext *context_;
+    const seal::Evaluator *evaluator_;
+    const seal::BatchEncoder *batch_encoder_;
+    ResponseCodec response_codec_;
+    std::map<uint32_t, ClientKeysPtr> client_keys_;
     size_t plaint_bit_count_;
     size_t polynomial_degree_;
     vector<size_t> pir_dimensions_;
@@ -56,7 +109,8 @@ private:
     size_t gap_;
     bool is_db_preprocessed_;
     bool is_client_keys_set_;
-    PIRQuery query_; 
+    bool lazy_relin_ = false;
+    std::array<double, 3> stage_times_ = {0, 0, 0};
     size_t num_databases_;
 
     uint64_t server_id_ = 0;
@@ -69,6 +123,12 @@ private:
     std::vector<PirDB>  db_list_;
     std::vector<seal::Plaintext> encoded_db_;
 
+    // Selection masks used when merging responses. They only depend on the parameters,
+    // so they are encoded once, in NTT form at the level of the responses.
+    seal::parms_id_type response_parms_id_;
+    std::vector<seal::Plaintext> chunk_selection_masks_;  // width gap_ * rounded slots per entry
+    std::vector<seal::Plaintext> bucket_selection_masks_; // width gap_
+
     
     RawDB populate_return_raw_db();
     void round_dbs();
@@ -77,18 +137,26 @@ private:
     PirDB convert_to_pir_db(int rawdb_index);
     void merge_pir_dbs();
 
-    std::vector<uint64_t> convert_to_list_of_coeff(std::vector<unsigned char> input_list);
+    std::vector<uint64_t> convert_to_list_of_coeff(const std::vector<unsigned char> &input_list);
     void rotate_db_cols();
-    vector<seal::Ciphertext> rotate_copy_query(uint32_t client_id);
+    const ClientKeys &get_keys(uint32_t client_id) const;
+    vector<seal::Ciphertext> rotate_copy_query(const RequestContext &request) const;
     void encode_db();
+    // new_db is consumed, pass it with std::move
     void merge_to_db(PirDB new_db, int rotation_index);
+    void prepare_selection_masks();
+    seal::Plaintext encode_selection_mask(size_t begin, size_t width);
+    void multiply_selection_mask(Ciphertext &ct, const seal::Plaintext &mask, seal::MemoryPoolHandle pool) const;
 
-    vector<Ciphertext> process_first_dimension(uint32_t client_id);
-    vector<Ciphertext> old_process_first_dimension_delayed_mod(uint32_t client_id);
-    vector<Ciphertext> process_first_dimension_delayed_mod(uint32_t client_id);
+    vector<Ciphertext> process_first_dimension(RequestContext &request) const;
+    vector<Ciphertext> old_process_first_dimension_delayed_mod(RequestContext &request) const;
+    vector<Ciphertext> process_first_dimension_delayed_mod(RequestContext &request) const;
+    vector<vector<Ciphertext>> process_first_dimension_batched(vector<RequestContext> &requests) const;
+    PIRResponseList process_remaining_dimensions(RequestContext &request, const vector<Ciphertext> &first_intermediate_data) const;
 
-    vector<Ciphertext> process_second_dimension(uint32_t client_id, vector<Ciphertext> first_intermediate_data);
-    PIRResponseList process_last_dimension(uint32_t client_id, vector<Ciphertext> second_intermediate_data, bool is_2d_pir_);
+    vector<Ciphertext> process_second_dimension(RequestContext &request, const vector<Ciphertext> &first_intermediate_data) const;
+    vector<Ciphertext> process_second_dimension_lazy_relin(RequestContext &request, const vector<Ciphertext> &first_intermediate_data) const;
+    PIRResponseList process_last_dimension(RequestContext &request, const vector<Ciphertext> &second_intermediate_data, bool is_2d_pir_) const;
 
 
     // Check if rawdb_ has been generated correctly
@@ -106,7 +174,7 @@ private:
     void print_db();
     void print_encoded_db();
     void print_rawdb();
-    void modulus_switch(PIRResponseList& list);
+    void modulus_switch(PIRResponseList& list, seal::MemoryPoolHandle pool) const;
 };
 
 #endif // SERVER_H
@@ -7,6 +7,11 @@
 #include <iostream>
 #include <cstdint>
 #include <vector>
+#include <memory>
+#include <utility>
+#include <cstdio>
+#include <sys/resource.h>
+#include <unistd.h>
 #include "database_constants.h"
 #include "seal/seal.h"
 
@@ -17,6 +22,9 @@ typedef std::vector<std::vector<unsigned char>> RawDB;
 typedef std::vector<std::vector<unsigned char>> RawResponses;
 typedef std::vector<uint64_t> Row;
 typedef std::vector<Row> PirDB;
+typedef std::pair<seal::GaloisKeys, seal::RelinKeys> ClientKeys;
+// shared by all sub-servers instead of copied into each of them
+typedef std::shared_ptr<const ClientKeys> ClientKeysPtr;
 using namespace std;
 using namespace seal;
 
@@ -29,6 +37,34 @@ namespace utils
         return pow(2, ceil(log2(n)));
     }
 
+    // Peak resident set size of the process in KB
+    inline size_t get_peak_rss_kb()
+    {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+        {
+            return 0;
+        }
+        return static_cast<size_t>(usage.ru_maxrss);
+    }
+
+    // Current resident set size of the process in KB, 0 where /proc is not available
+    inline size_t get_current_rss_kb()
+    {
+        size_t pages = 0, resident = 0;
+        FILE *statm = fopen("/proc/self/statm", "r");
+        if (!statm)
+        {
+            return 0;
+        }
+        if (fscanf(statm, "%zu %zu", &pages, &resident) != 2)
+        {
+            resident = 0;
+        }
+        fclose(statm);
+        return resident * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+
     // Generates a random number between 0 and max_value
     inline uint32_t generate_random_number(uint32_t max_value)
     {
@@ -1,4 +1,5 @@
 #include "batchpirclient.h"
+#include <limits>
 
 BatchPIRClient::BatchPIRClient(const BatchPirParams &params)
     : batchpir_params_(params), is_cuckoo_generated_(false), is_map_set_(false)
@@ -8,7 +9,44 @@ BatchPIRClient::BatchPIRClient(const BatchPirParams &params)
     prepare_pir_clients();
 }
 
-bool BatchPIRClient::cuckoo_insert(uint64_t key, size_t attempt, std::unordered_map<uint64_t, std::vector<size_t>> key_to_buckets, std::unordered_map<uint64_t, uint64_t> &bucket_to_key)
+const BatchPirParams &BatchPIRClient::get_params() const
+{
+    return batchpir_params_;
+}
+
+const seal::SEALContext &BatchPIRClient::get_context() const
+{
+    return crypto_->get_context();
+}
+
+BatchPIRClient::QueryState BatchPIRClient::get_query_state() const
+{
+    QueryState state;
+    state.cuckoo_table = cuckoo_table_;
+    state.cuckoo_keys = cuckoo_keys_;
+    for (const auto &client : client_list_)
+    {
+        state.entry_slot_lists.push_back(client.get_entry_list());
+    }
+    return state;
+}
+
+void BatchPIRClient::set_query_state(QueryState state)
+{
+    if (state.entry_slot_lists.size() != client_list_.size())
+    {
+        throw std::invalid_argument("Error: Query state does not match the clients");
+    }
+    cuckoo_table_ = std::move(state.cuckoo_table);
+    cuckoo_keys_ = std::move(state.cuckoo_keys);
+    for (size_t i = 0; i < client_list_.size(); i++)
+    {
+        client_list_[i].set_entry_list(std::move(state.entry_slot_lists[i]));
+    }
+    is_cuckoo_generated_ = true;
+}
+
+bool BatchPIRClient::cuckoo_insert(uint64_t key, size_t attempt, const std::unordered_map<uint64_t, std::vector<size_t>> &key_to_buckets, std::unordered_map<uint64_t, uint64_t> &bucket_to_key)
 {
     if (attempt > max_attempts_)
     {
@@ -16,7 +54,8 @@ bool BatchPIRClient::cuckoo_insert(uint64_t key, size_t attempt, std::unordered_
         return false;
     }
 
-    for (auto v : key_to_buckets[key])
+    const std::vector<size_t> &candidate_buckets = key_to_buckets.at(key);
+    for (auto v : candidate_buckets)
     {
         if (bucket_to_key.find(v) == bucket_to_key.end())
         {
@@ -25,7 +64,6 @@ bool BatchPIRClient::cuckoo_insert(uint64_t key, size_t attempt, std::unordered_
         }
     }
 
-    std::vector<size_t> candidate_buckets = key_to_buckets[key];
     int idx = rand() % candidate_buckets.size();
     auto picked_bucket = candidate_buckets[idx];
     auto old = bucket_to_key[picked_bucket];
@@ -35,7 +73,7 @@ bool BatchPIRClient::cuckoo_insert(uint64_t key, size_t attempt, std::unordered_
     return true;
 }
 
-vector<PIRQuery> BatchPIRClient::create_queries(vector<uint64_t> batch)
+vector<PIRQuery> BatchPIRClient::create_queries(const vector<uint64_t> &batch)
 {
 
     if (batch.size() != batchpir_params_.get_batch_size())
@@ -60,7 +98,7 @@ vector<PIRQuery> BatchPIRClient::create_queries(vector<uint64_t> batch)
         previous_idx += offset;
         auto query = client_list_[i].gen_query(sub_buckets);
         measure_size(query, 2);
-        queries.push_back(query);
+        queries.push_back(std::move(query));
     }
 
     return queries;
@@ -68,7 +106,25 @@ vector<PIRQuery> BatchPIRClient::create_queries(vector<uint64_t> batch)
 
 
 
-bool BatchPIRClient::cuckoo_hash(vector<uint64_t> batch)
+void BatchPIRClient::precompute_queries(size_t num_batches)
+{
+    for (auto &client : client_list_)
+    {
+        client.precompute_queries(num_batches);
+    }
+}
+
+size_t BatchPIRClient::get_num_precomputed_queries() const
+{
+    size_t num_batches = std::numeric_limits<size_t>::max();
+    for (const auto &client : client_list_)
+    {
+        num_batches = std::min(num_batches, client.get_num_precomputed_queries());
+    }
+    return client_list_.empty() ? 0 : num_batches;
+}
+
+bool BatchPIRClient::cuckoo_hash(const vector<uint64_t> &batch)
 {
 
     if (!is_map_set_)
@@ -87,13 +143,14 @@ bool BatchPIRClient::cuckoo_hash(vector<uint64_t> batch)
         throw std::invalid_argument("Error: Batch size is wrong");
     }
 
-    cuckoo_table_.resize(std::ceil(batchpir_params_.get_batch_size() * batchpir_params_.get_cuckoo_factor()), batchpir_params_.get_default_value());
+    // cleared on every call, after translate_cuckoo the previous batch left bucket positions here
+    cuckoo_table_.assign(std::ceil(batchpir_params_.get_batch_size() * batchpir_params_.get_cuckoo_factor()), batchpir_params_.get_default_value());
 
     std::unordered_map<uint64_t, std::vector<size_t>> key_to_buckets;
     for (auto v : batch)
     {
-        auto candidates = utils::get_candidate_buckets(v, num_candidates, total_buckets);
-        key_to_buckets[v] = candidates;
+        auto candidates = batchpir_params_.get_candidate_buckets(v);
+        key_to_buckets[v] = std::move(candidates);
     }
     std::unordered_map<uint64_t, uint64_t> bucket_to_key;
 
@@ -118,7 +175,7 @@ bool BatchPIRClient::cuckoo_hash(vector<uint64_t> batch)
     return true;
 }
 
-bool BatchPIRClient::cuckoo_hash_witout_checks(vector<uint64_t> batch)
+bool BatchPIRClient::cuckoo_hash_witout_checks(const vector<uint64_t> &batch)
 {
 
     auto total_buckets = ceil(batchpir_params_.get_cuckoo_factor() * batchpir_params_.get_batch_size());
@@ -132,13 +189,14 @@ bool BatchPIRClient::cuckoo_hash_witout_checks(vector<uint64_t> batch)
         throw std::invalid_argument("Error: Batch size is wrong");
     }
 
-    cuckoo_table_.resize(std::ceil(batchpir_params_.get_batch_size() * batchpir_params_.get_cuckoo_factor()), batchpir_params_.get_default_value());
+    // cleared on every call, after translate_cuckoo the previous batch left bucket positions here
+    cuckoo_table_.assign(std::ceil(batchpir_params_.get_batch_size() * batchpir_params_.get_cuckoo_factor()), batchpir_params_.get_default_value());
 
     std::unordered_map<uint64_t, std::vector<size_t>> key_to_buckets;
     for (auto v : batch)
     {
-        auto candidates = utils::get_candidate_buckets(v, num_candidates, total_buckets);
-        key_to_buckets[v] = candidates;
+        auto candidates = batchpir_params_.get_candidate_buckets(v);
+        key_to_buckets[v] = std::move(candidates);
     }
     std::unordered_map<uint64_t, uint64_t> bucket_to_key;
 
@@ -163,7 +221,7 @@ bool BatchPIRClient::cuckoo_hash_witout_checks(vector<uint64_t> batch)
     return true;
 }
 
-void BatchPIRClient::measure_size(vector<Ciphertext> list, size_t seeded){
+void BatchPIRClient::measure_size(const vector<Ciphertext> &list, size_t seeded){
 
 
     for (int i=0; i < list.size(); i++){
@@ -176,18 +234,29 @@ size_t BatchPIRClient::get_serialized_commm_size(){
 }
 
 
-void BatchPIRClient::set_map(std::unordered_map<std::string, uint64_t> map)
+void BatchPIRClient::set_map(const std::unordered_map<std::string, uint64_t> &map)
 {
     map_ = map;
     is_map_set_ = true;
 }
 
+void BatchPIRClient::set_map(std::unordered_map<std::string, uint64_t> &&map)
+{
+    map_ = std::move(map);
+    is_map_set_ = true;
+}
+
 
 vector<uint64_t> BatchPIRClient::get_cuckoo_table()
 {
     return cuckoo_table_;
 }
 
+const vector<uint64_t> &BatchPIRClient::get_cuckoo_keys() const
+{
+    return cuckoo_keys_;
+}
+
 void BatchPIRClient::translate_cuckoo()
 {
     if (!is_map_set_ || !is_cuckoo_generated_)
@@ -195,6 +264,7 @@ void BatchPIRClient::translate_cuckoo()
         throw std::runtime_error("Error: Cannot translate the data because either the map has not been set or the cuckoo hash table has not been generated.");
     }
 
+    cuckoo_keys_ = cuckoo_table_;
     auto num_buckets = cuckoo_table_.size();
     for (int i = 0; i < num_buckets; i++)
     {
@@ -202,7 +272,12 @@ void BatchPIRClient::translate_cuckoo()
         if (cuckoo_table_[i] != batchpir_params_.get_default_value())
         {
             // convert from db index to bucket index
-            cuckoo_table_[i] = map_[to_string(cuckoo_table_[i]) + to_string(i)];
+            auto position = map_.find(to_string(cuckoo_table_[i]) + to_string(i));
+            if (position == map_.end())
+            {
+                throw std::runtime_error("Error: Entry " + to_string(cuckoo_table_[i]) + " is not in bucket " + to_string(i));
+            }
+            cuckoo_table_[i] = position->second;
         }
     }
 }
@@ -220,39 +295,58 @@ void BatchPIRClient::prepare_pir_clients()
     size_t num_client = ceil(num_buckets / per_client_capacity);
     auto remaining_buckets = num_buckets;
     auto previous_idx = 0;
-    seal::KeyGenerator *keygen;
+    // one SEAL context for all sub-clients, they use the same parameters
+    auto crypto = make_crypto_context(batchpir_params_.get_seal_parameters());
+    crypto_ = crypto;
+    std::shared_ptr<seal::KeyGenerator> keygen;
 
     for (int i = 0; i < num_client; i++)
     {
         const size_t num_dbs = std::min(per_client_capacity, static_cast<size_t>(num_buckets - previous_idx));
         previous_idx += num_dbs;
         PirParams params(max_bucket_size, entry_size, num_dbs, batchpir_params_.get_seal_parameters(), dim_size);
+        // all sub-clients share the dimensions, so the Galois and relinearization keys of
+        // the first client cover every server and are generated only once
         if (i == 0)
         {
-            Client client(params);
-            client_list_.push_back(client);
-            keygen = client.get_keygen();
+            client_list_.push_back(Client(params, crypto));
+            keygen = client_list_.back().get_keygen();
         }
         else
         {
-            Client client(params, keygen);
-            client_list_.push_back(client);
+            client_list_.push_back(Client(params, keygen, crypto));
         }
     }
 }
 
-vector<RawDB> BatchPIRClient::decode_responses(vector<PIRResponseList> responses)
+vector<RawDB> BatchPIRClient::decode_responses(const vector<PIRResponseList> &responses)
 {
     vector<std::vector<std::vector<unsigned char>>> entries_list;
     for (int i = 0; i < responses.size(); i++)
     {
-        std::vector<std::vector<unsigned char>> entries = client_list_[i].decode_responses(responses[i]);
-        entries_list.push_back(entries);
+        entries_list.push_back(client_list_[i].decode_responses(responses[i]));
     }
     return entries_list;
 }
 
-vector<RawDB> BatchPIRClient::decode_responses_chunks(PIRResponseList responses)
+vector<RawDB> BatchPIRClient::decode_compressed_responses(const CompressedResponseList &responses)
+{
+    // the compressed responses are exactly what goes over the wire
+    for (const auto &response : responses)
+    {
+        serialized_comm_size_ += response.size();
+    }
+    // the decompressed ciphertexts were never sent, so they are not measured again
+    return decode_chunks(client_list_[0].decompress_responses(responses));
+}
+
+vector<RawDB> BatchPIRClient::decode_responses_chunks(const PIRResponseList &responses)
+{
+    measure_size(responses, 1);
+    return decode_chunks(responses);
+}
+
+vector<RawDB> BatchPIRClient::decode_chunks(const PIRResponseList &responses)
 {
     vector<std::vector<std::vector<unsigned char>>> entries_list;
     const size_t num_slots_per_entry = batchpir_params_.get_num_slots_per_entry();
@@ -261,8 +355,6 @@ vector<RawDB> BatchPIRClient::decode_responses_chunks(PIRResponseList responses)
     const size_t row_size = batchpir_params_.get_seal_parameters().poly_modulus_degree() / 2;
     const size_t gap = row_size / max_empty_slots;
 
-    measure_size(responses, 1);
-
     auto current_fill = gap * num_slots_per_entry_rounded;
     size_t num_buckets_merged = (row_size / current_fill);
 
@@ -274,9 +366,8 @@ vector<RawDB> BatchPIRClient::decode_responses_chunks(PIRResponseList responses)
         for (int i = 0; i < client_list_.size(); i++)
         {
             auto start_idx = (i * num_chunk_ctx);
-            PIRResponseList subvector(responses.begin() + start_idx, responses.begin() + start_idx + num_chunk_ctx);
-            std::vector<std::vector<unsigned char>> entries = client_list_[i].decode_responses(subvector);
-            entries_list.push_back(entries);
+            auto begin = responses.begin() + start_idx;
+            entries_list.push_back(client_list_[i].decode_responses(begin, begin + num_chunk_ctx));
         }
     }
     else
@@ -292,9 +383,7 @@ vector<RawDB> BatchPIRClient::decode_responses_chunks(PIRResponseList responses)
     return entries_list;
 }
 
-std::pair<seal::GaloisKeys, seal::RelinKeys> BatchPIRClient::get_public_keys()
+const ClientKeys &BatchPIRClient::get_public_keys() const
 {
-    std::pair<seal::GaloisKeys, seal::RelinKeys> keys;
-    keys = client_list_[0].get_public_keys();
-    return keys;
+    return client_list_[0].get_public_keys();
 }
\ No newline at end of file
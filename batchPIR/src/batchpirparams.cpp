@@ -13,48 +13,48 @@ BatchPirParams::BatchPirParams(int batch_size, size_t num_entries, size_t entry_
 
       }
 
-int BatchPirParams::get_num_hash_funcs() {
+int BatchPirParams::get_num_hash_funcs() const {
     return num_hash_funcs_;
 }
 
-seal::EncryptionParameters BatchPirParams::get_seal_parameters() const
+const seal::EncryptionParameters &BatchPirParams::get_seal_parameters() const
 {
     return seal_params_;
 }
 
-uint32_t BatchPirParams::get_num_slots_per_entry() {
+uint32_t BatchPirParams::get_num_slots_per_entry() const {
     return ceil((8 * entry_size_ * 1.0) / (seal_params_.plain_modulus().bit_count()-1));
 }
 
-int BatchPirParams::get_batch_size() {
+int BatchPirParams::get_batch_size() const {
     return batch_size_;
 }
 
-double BatchPirParams::get_cuckoo_factor() {
+double BatchPirParams::get_cuckoo_factor() const {
     return cuckoo_factor_;
 }
 
-size_t BatchPirParams::get_num_entries() {
+size_t BatchPirParams::get_num_entries() const {
     return num_entries_;
 }
 
-size_t BatchPirParams::get_entry_size() {
+size_t BatchPirParams::get_entry_size() const {
     return entry_size_;
 }
 
-size_t BatchPirParams::get_max_attempts() {
+size_t BatchPirParams::get_max_attempts() const {
     return max_attempts_;
 }
 
-size_t BatchPirParams::get_max_bucket_size() {
+size_t BatchPirParams::get_max_bucket_size() const {
     return max_bucket_size_;
 }
 
-size_t BatchPirParams::get_first_dimension_size() {
+size_t BatchPirParams::get_first_dimension_size() const {
     return dim_size_;
 }
 
-uint64_t BatchPirParams::get_default_value(){
+uint64_t BatchPirParams::get_default_value() const {
     return default_value_;
 }
 
@@ -78,6 +78,57 @@ void BatchPirParams::set_max_bucket_size(size_t max_bucket_size){
 }
 
 
+size_t BatchPirParams::get_total_buckets() const {
+    return ceil(batch_size_ * cuckoo_factor_);
+}
+
+void BatchPirParams::set_entries_per_group(size_t entries_per_group){
+    if (entries_per_group != 0 && (num_entries_ + entries_per_group - 1) / entries_per_group * num_hash_funcs_ > get_total_buckets())
+    {
+        throw std::invalid_argument("Error: Too many entry groups, every group needs at least num_hash_funcs buckets");
+    }
+    entries_per_group_ = entries_per_group;
+}
+
+size_t BatchPirParams::get_entries_per_group() const {
+    return entries_per_group_;
+}
+
+size_t BatchPirParams::get_num_groups() const {
+    if (entries_per_group_ == 0)
+        return 1;
+    return (num_entries_ + entries_per_group_ - 1) / entries_per_group_;
+}
+
+size_t BatchPirParams::get_group(uint64_t index) const {
+    return entries_per_group_ == 0 ? 0 : index / entries_per_group_;
+}
+
+std::pair<size_t, size_t> BatchPirParams::get_group_buckets(size_t group) const {
+    const size_t total_buckets = get_total_buckets();
+    const size_t num_groups = get_num_groups();
+    if (group >= num_groups)
+    {
+        throw std::out_of_range("Error: Entry group out of range");
+    }
+    return std::make_pair(group * total_buckets / num_groups, (group + 1) * total_buckets / num_groups);
+}
+
+size_t BatchPirParams::get_group_capacity(size_t group) const {
+    auto buckets = get_group_buckets(group);
+    return std::max<size_t>(1, static_cast<size_t>((buckets.second - buckets.first) / cuckoo_factor_));
+}
+
+std::vector<size_t> BatchPirParams::get_candidate_buckets(uint64_t index) const {
+    auto buckets = get_group_buckets(get_group(index));
+    auto candidates = utils::get_candidate_buckets(index, num_hash_funcs_, buckets.second - buckets.first);
+    for (auto &b : candidates)
+    {
+        b += buckets.first;
+    }
+    return candidates;
+}
+
 void BatchPirParams::print_params() const {
 std::cout << "+---------------------------------------------------+" << std::endl;
 std::cout << "|                  Batch Parameters                 |" << std::endl;
@@ -87,5 +138,7 @@ std::cout << std::left << std::setw(20) << "| batch_size_: " << batch_size_ << s
 std::cout << std::left << std::setw(20) << "| cuckoo_factor_: " << cuckoo_factor_ << std::endl;
 std::cout << std::left << std::setw(20) << "| num_entries_: " << num_entries_ << std::endl;
 std::cout << std::left << std::setw(20) << "| max_attempts_: " << max_attempts_ << std::endl;
+if (entries_per_group_)
+    std::cout << std::left << std::setw(20) << "| entries_per_group_: " << entries_per_group_ << " (" << get_num_groups() << " groups)" << std::endl;
 std::cout << "+---------------------------------------------------+" << std::endl;
 }
\ No newline at end of file
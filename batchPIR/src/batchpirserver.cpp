@@ -1,16 +1,26 @@
 #include "batchpirserver.h"
 
-BatchPIRServer::BatchPIRServer(BatchPirParams &params)
-    : is_client_keys_set_(false), is_simple_hash_(false)
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+BatchPIRServer::BatchPIRServer(const BatchPirParams &params)
+    : batchpir_params_(params), is_client_keys_set_(false), is_simple_hash_(false)
 {
-    batchpir_params_ = &params;
+}
+
+const BatchPirParams &BatchPIRServer::get_params() const
+{
+    return batchpir_params_;
 }
 
 void BatchPIRServer::setEntries(uint8_t *entries)
 {
     std::cout << "BatchPIRServer: Populating database..." << std::endl;
-    auto db_entries = batchpir_params_->get_num_entries();
-    auto entry_size = batchpir_params_->get_entry_size();
+    auto db_entries = batchpir_params_.get_num_entries();
+    auto entry_size = batchpir_params_.get_entry_size();
 
     // Resize the rawdb vector to the correct size
     rawdb_.resize(db_entries);
@@ -35,8 +45,8 @@ void BatchPIRServer::setEntries(uint8_t *entries)
 
 void BatchPIRServer::populate_raw_db()
 {
-    auto db_entries = batchpir_params_->get_num_entries();
-    auto entry_size = batchpir_params_->get_entry_size();
+    auto db_entries = batchpir_params_.get_num_entries();
+    auto entry_size = batchpir_params_.get_entry_size();
 
     // Resize the rawdb vector to the correct size
     rawdb_.resize(db_entries);
@@ -60,7 +70,16 @@ void BatchPIRServer::populate_raw_db()
     }
 }
 
-std::unordered_map<std::string, uint64_t> BatchPIRServer::get_hash_map() const
+const seal::SEALContext &BatchPIRServer::get_context() const
+{
+    if (!crypto_)
+    {
+        throw std::logic_error("Error: PIR servers are not prepared yet");
+    }
+    return crypto_->get_context();
+}
+
+const std::unordered_map<std::string, uint64_t> &BatchPIRServer::get_hash_map() const
 {
 
     if (!is_simple_hash_)
@@ -102,18 +121,21 @@ size_t BatchPIRServer::get_avg_bucket_size() const
 
 void BatchPIRServer::simeple_hash()
 {
-    auto total_buckets = ceil(batchpir_params_->get_cuckoo_factor() * batchpir_params_->get_batch_size());
-    auto db_entries = batchpir_params_->get_num_entries();
-    auto num_candidates = batchpir_params_->get_num_hash_funcs();
+    auto total_buckets = ceil(batchpir_params_.get_cuckoo_factor() * batchpir_params_.get_batch_size());
+    auto db_entries = batchpir_params_.get_num_entries();
+    auto num_candidates = batchpir_params_.get_num_hash_funcs();
     buckets_.resize(total_buckets);
 
     std::cout << total_buckets << " " << db_entries << " " << num_candidates << std::endl;
 
+    entry_positions_.resize(db_entries * num_candidates);
     for (uint64_t i = 0; i < db_entries; i++)
     {
-        std::vector<size_t> candidates = utils::get_candidate_buckets(i, num_candidates, total_buckets);
-        for (auto b : candidates)
+        std::vector<size_t> candidates = batchpir_params_.get_candidate_buckets(i);
+        for (size_t c = 0; c < candidates.size(); c++)
         {
+            auto b = candidates[c];
+            entry_positions_[i * num_candidates + c] = buckets_[b].size();
             buckets_[b].push_back(rawdb_[i]);
             map_[to_string(i) + to_string(b)] = buckets_[b].size();
         }
@@ -121,22 +143,22 @@ void BatchPIRServer::simeple_hash()
 
     print_stats();
 
-    batchpir_params_->set_max_bucket_size(get_max_bucket_size());
+    batchpir_params_.set_max_bucket_size(get_max_bucket_size());
     balance_buckets();
 }
 
 std::vector<std::vector<uint64_t>> BatchPIRServer::simeple_hash_with_map()
 {
-    auto total_buckets = ceil(batchpir_params_->get_cuckoo_factor() * batchpir_params_->get_batch_size());
-    auto db_entries = batchpir_params_->get_num_entries();
-    auto num_candidates = batchpir_params_->get_num_hash_funcs();
+    auto total_buckets = ceil(batchpir_params_.get_cuckoo_factor() * batchpir_params_.get_batch_size());
+    auto db_entries = batchpir_params_.get_num_entries();
+    auto num_candidates = batchpir_params_.get_num_hash_funcs();
     buckets_.resize(total_buckets);
 
     std::vector<std::vector<uint64_t>> map(total_buckets);
 
     for (int i = 0; i < db_entries; i++)
     {
-        std::vector<size_t> candidates = utils::get_candidate_buckets(i, num_candidates, total_buckets);
+        std::vector<size_t> candidates = batchpir_params_.get_candidate_buckets(i);
         for (auto b : candidates)
         {
             buckets_[b].push_back(rawdb_[i]);
@@ -147,7 +169,7 @@ std::vector<std::vector<uint64_t>> BatchPIRServer::simeple_hash_with_map()
     // print_stats();
 
     cout << "get_max_bucket_size: " << get_max_bucket_size() << endl;
-    batchpir_params_->set_max_bucket_size(get_max_bucket_size());
+    batchpir_params_.set_max_bucket_size(get_max_bucket_size());
     balance_buckets();
     is_simple_hash_ = true;
 
@@ -156,9 +178,9 @@ std::vector<std::vector<uint64_t>> BatchPIRServer::simeple_hash_with_map()
 
 void BatchPIRServer::balance_buckets()
 {
-    auto max_bucket = batchpir_params_->get_max_bucket_size();
+    auto max_bucket = batchpir_params_.get_max_bucket_size();
     auto num_buckets = buckets_.size();
-    auto entry_size = batchpir_params_->get_entry_size();
+    auto entry_size = batchpir_params_.get_entry_size();
 
     auto generate_one_entry = [entry_size]() -> std::vector<unsigned char>
     {
@@ -207,17 +229,22 @@ void BatchPIRServer::prepare_pir_server()
         throw std::logic_error("Error: Simple hash must be performed before preparing PIR server.");
     }
 
-    size_t max_bucket_size = batchpir_params_->get_max_bucket_size();
-    size_t entry_size = batchpir_params_->get_entry_size();
-    size_t dim_size = batchpir_params_->get_first_dimension_size();
-    auto max_slots = batchpir_params_->get_seal_parameters().poly_modulus_degree();
+    size_t max_bucket_size = batchpir_params_.get_max_bucket_size();
+    size_t entry_size = batchpir_params_.get_entry_size();
+    size_t dim_size = batchpir_params_.get_first_dimension_size();
+    auto max_slots = batchpir_params_.get_seal_parameters().poly_modulus_degree();
     auto num_buckets = buckets_.size();
     size_t per_server_capacity = max_slots / dim_size;
+    per_server_capacity_ = per_server_capacity;
     size_t num_servers = ceil(num_buckets * 1.0 / per_server_capacity);
 
     std::cout << max_bucket_size << " " << entry_size << " " << dim_size << " " << max_slots
               << " " << num_buckets << " " << per_server_capacity << " " << num_servers << "\n";
 
+    // one SEAL context for all servers, they use the same parameters
+    auto crypto = make_crypto_context(batchpir_params_.get_seal_parameters());
+    crypto_ = crypto;
+
     auto remaining_buckets = num_buckets;
     auto previous_idx = 0;
     for (int i = 0; i < num_servers; i++)
@@ -226,19 +253,74 @@ void BatchPIRServer::prepare_pir_server()
         vector<RawDB> sub_buckets(buckets_.begin() + previous_idx, buckets_.begin() + previous_idx + offset);
         previous_idx += offset;
 
-        PirParams params(max_bucket_size, entry_size, offset, batchpir_params_->get_seal_parameters(), dim_size);
+        PirParams params(max_bucket_size, entry_size, offset, batchpir_params_.get_seal_parameters(), dim_size);
         params.print_values();
-        Server server(params, sub_buckets);
+        server_list_.push_back(Server(params, std::move(sub_buckets), crypto));
+        server_list_.back().set_lazy_relinearization(lazy_relin_);
+    }
+}
+
+size_t BatchPIRServer::update_entries(const std::vector<uint64_t> &indices, const uint8_t *entries)
+{
+    if (server_list_.empty())
+    {
+        throw std::logic_error("Error: PIR servers must be prepared before entries can be updated.");
+    }
+
+    auto db_entries = batchpir_params_.get_num_entries();
+    auto entry_size = batchpir_params_.get_entry_size();
+    auto num_candidates = batchpir_params_.get_num_hash_funcs();
+    auto total_buckets = buckets_.size();
 
-        server_list_.push_back(server);
+    // group the changed bucket entries by the server that holds the bucket
+    vector<vector<size_t>> db_indices(server_list_.size()), entry_indices(server_list_.size());
+    vector<RawDB> new_entries(server_list_.size());
+    for (size_t k = 0; k < indices.size(); k++)
+    {
+        auto i = indices[k];
+        if (i >= db_entries)
+        {
+            throw std::out_of_range("Error: update_entries index out of range");
+        }
+
+        rawdb_[i].assign(entries + k * entry_size, entries + (k + 1) * entry_size);
+
+        std::vector<size_t> candidates = batchpir_params_.get_candidate_buckets(i);
+        for (size_t c = 0; c < candidates.size(); c++)
+        {
+            auto b = candidates[c];
+            auto pos = entry_positions_[i * num_candidates + c];
+            buckets_[b][pos] = rawdb_[i];
+
+            auto s = b / per_server_capacity_;
+            db_indices[s].push_back(b % per_server_capacity_);
+            entry_indices[s].push_back(pos);
+            new_entries[s].push_back(rawdb_[i]);
+        }
     }
+
+    size_t num_encoded = 0;
+    for (size_t s = 0; s < server_list_.size(); s++)
+    {
+        if (db_indices[s].size())
+        {
+            num_encoded += server_list_[s].update_entries(db_indices[s], entry_indices[s], new_entries[s]);
+        }
+    }
+    return num_encoded;
 }
 
-void BatchPIRServer::set_client_keys(uint32_t client_id, std::pair<seal::GaloisKeys, seal::RelinKeys> keys)
+void BatchPIRServer::set_client_keys(uint32_t client_id, const ClientKeys &keys)
 {
+    set_client_keys(client_id, ClientKeys(keys));
+}
+
+void BatchPIRServer::set_client_keys(uint32_t client_id, ClientKeys &&keys)
+{
+    ClientKeysPtr shared_keys = std::make_shared<const ClientKeys>(std::move(keys));
     for (int i = 0; i < server_list_.size(); i++)
     {
-        server_list_[i].set_client_keys(client_id, keys);
+        server_list_[i].set_client_keys(client_id, shared_keys);
     }
     is_client_keys_set_ = true;
 }
@@ -252,33 +334,199 @@ void BatchPIRServer::get_client_keys()
     }
 }
 
-PIRResponseList BatchPIRServer::generate_response(uint32_t client_id, vector<PIRQuery> queries)
+PIRResponseList BatchPIRServer::generate_response(uint32_t client_id, const vector<PIRQuery> &queries)
+{
+    return process_request(client_id, queries, stage_times_);
+}
+
+PIRResponseList BatchPIRServer::process_request(uint32_t client_id, const vector<PIRQuery> &queries, std::array<double, 4> &stage_times, seal::MemoryPoolHandle pool) const
 {
 
     if (!is_client_keys_set_)
     {
         throw std::runtime_error("Error: Client keys not set");
     }
+    if (queries.size() != server_list_.size())
+    {
+        throw std::invalid_argument("Error: Expected one query per PIR server");
+    }
     vector<PIRResponseList> responses;
 
+    stage_times.fill(0);
     for (int i = 0; i < server_list_.size(); i++)
     {
-        responses.push_back(server_list_[i].generate_response(client_id, queries[i]));
+        RequestContext request = server_list_[i].make_request_context(client_id, queries[i], pool);
+        responses.push_back(server_list_[i].generate_response(request));
+        for (size_t j = 0; j < request.stage_times.size(); j++)
+        {
+            stage_times[j] += request.stage_times[j];
+        }
+    }
+
+    auto start = chrono::high_resolution_clock::now();
+    auto merged = merge_responses(responses, client_id, pool);
+    stage_times[3] = chrono::duration<double, std::milli>(chrono::high_resolution_clock::now() - start).count();
+    return merged;
+}
+
+namespace
+{
+    // Runs task(k, pool) for k < count on num_threads threads, every thread takes the next
+    // k until none are left and allocates from a pool of its own, so allocations do not
+    // contend with the other threads. Rethrows the first exception, returns the number of
+    // bytes the pools allocated.
+    size_t run_on_threads(size_t count, size_t num_threads, const std::function<void(size_t, seal::MemoryPoolHandle &)> &task)
+    {
+        std::atomic<size_t> next(0);
+        std::atomic<size_t> alloc_bytes(0);
+        std::exception_ptr error;
+        std::mutex error_mutex;
+
+        auto worker = [&]()
+        {
+            auto pool = seal::MemoryPoolHandle::New();
+            for (size_t k = next++; k < count; k = next++)
+            {
+                try
+                {
+                    task(k, pool);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!error)
+                        error = std::current_exception();
+                }
+            }
+            alloc_bytes += pool.alloc_byte_count();
+        };
+
+        num_threads = std::max<size_t>(1, std::min(num_threads, count));
+        vector<std::thread> threads;
+        for (size_t t = 1; t < num_threads; t++)
+        {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+        return alloc_bytes;
+    }
+}
+
+vector<PIRResponseList> BatchPIRServer::generate_responses(const vector<uint32_t> &client_ids, const vector<vector<PIRQuery>> &queries, size_t num_threads, size_t *pool_alloc_bytes) const
+{
+    if (client_ids.size() != queries.size())
+    {
+        throw std::invalid_argument("Error: Expected one query batch per client id");
+    }
+
+    vector<PIRResponseList> responses(client_ids.size());
+    auto alloc_bytes = run_on_threads(client_ids.size(), num_threads, [&](size_t k, seal::MemoryPoolHandle &pool)
+    {
+        std::array<double, 4> stage_times;
+        responses[k] = process_request(client_ids[k], queries[k], stage_times, pool);
+    });
+
+    if (pool_alloc_bytes)
+    {
+        *pool_alloc_bytes = alloc_bytes;
+    }
+    return responses;
+}
+
+vector<PIRResponseList> BatchPIRServer::generate_batched_responses(const vector<uint32_t> &client_ids, const vector<vector<PIRQuery>> &queries, size_t num_threads, size_t *pool_alloc_bytes) const
+{
+    if (!is_client_keys_set_)
+    {
+        throw std::runtime_error("Error: Client keys not set");
+    }
+    if (client_ids.size() != queries.size())
+    {
+        throw std::invalid_argument("Error: Expected one query batch per client id");
+    }
+    for (const auto &client_queries : queries)
+    {
+        if (client_queries.size() != server_list_.size())
+        {
+            throw std::invalid_argument("Error: Expected one query per PIR server");
+        }
     }
 
-    return merge_responses(responses, client_id);
+    // server_responses[k][i] is the response of server i to client k. The PIR servers are
+    // spread over the threads, each scans its database once for all clients.
+    vector<vector<PIRResponseList>> server_responses(client_ids.size(), vector<PIRResponseList>(server_list_.size()));
+    auto alloc_bytes = run_on_threads(server_list_.size(), num_threads, [&](size_t i, seal::MemoryPoolHandle &pool)
+    {
+        vector<RequestContext> requests;
+        for (size_t k = 0; k < client_ids.size(); k++)
+        {
+            requests.push_back(server_list_[i].make_request_context(client_ids[k], queries[k][i], pool));
+        }
+
+        auto responses = server_list_[i].generate_responses(requests);
+        for (size_t k = 0; k < client_ids.size(); k++)
+        {
+            server_responses[k][i] = std::move(responses[k]);
+        }
+    });
+
+    // then the responses of every client are merged, also spread over the threads
+    vector<PIRResponseList> merged(client_ids.size());
+    alloc_bytes += run_on_threads(client_ids.size(), num_threads, [&](size_t k, seal::MemoryPoolHandle &pool)
+    {
+        merged[k] = merge_responses(server_responses[k], client_ids[k], pool);
+    });
+
+    if (pool_alloc_bytes)
+    {
+        *pool_alloc_bytes = alloc_bytes;
+    }
+    return merged;
+}
+
+CompressedResponseList BatchPIRServer::generate_compressed_response(uint32_t client_id, const vector<PIRQuery> &queries)
+{
+    auto responses = generate_response(client_id, queries);
+    return server_list_[0].compress_responses(responses);
+}
+
+void BatchPIRServer::set_lazy_relinearization(bool lazy)
+{
+    lazy_relin_ = lazy;
+    for (auto &server : server_list_)
+    {
+        server.set_lazy_relinearization(lazy);
+    }
+}
+
+std::array<double, 4> BatchPIRServer::get_stage_times() const
+{
+    return stage_times_;
+}
+
+size_t BatchPIRServer::get_num_servers() const
+{
+    return server_list_.size();
 }
 
-PIRResponseList BatchPIRServer::merge_responses(vector<PIRResponseList> &responses, uint32_t client_id)
+PIRResponseList BatchPIRServer::merge_responses(vector<PIRResponseList> &responses, uint32_t client_id, seal::MemoryPoolHandle pool) const
 {
-    return server_list_[0].merge_responses_chunks_buckets(responses, client_id);
+    return server_list_[0].merge_responses_chunks_buckets(responses, client_id, pool);
 }
 
-bool BatchPIRServer::check_decoded_entries(vector<std::vector<std::vector<unsigned char>>> entries_list, vector<uint64_t> cuckoo_table)
+bool BatchPIRServer::check_decoded_entries(const vector<std::vector<std::vector<unsigned char>>> &entries_list, const vector<uint64_t> &cuckoo_table)
 {
-    size_t entry_size = batchpir_params_->get_entry_size();
-    size_t dim_size = batchpir_params_->get_first_dimension_size();
-    auto max_slots = batchpir_params_->get_seal_parameters().poly_modulus_degree();
+    size_t entry_size = batchpir_params_.get_entry_size();
+    size_t dim_size = batchpir_params_.get_first_dimension_size();
+    auto max_slots = batchpir_params_.get_seal_parameters().poly_modulus_degree();
     auto num_buckets = cuckoo_table.size();
     size_t per_server_capacity = max_slots / dim_size;
     size_t num_servers = ceil(num_buckets / per_server_capacity);
@@ -1,18 +1,21 @@
 #include "client.h"
 
 // Constructor
-Client::Client(PirParams &pir_params) : pir_params_(pir_params)
+Client::Client(PirParams &pir_params, CryptoContextPtr crypto) : pir_params_(pir_params)
 {
 
-    context_ = new seal::SEALContext(pir_params.get_seal_parameters());
-    batch_encoder_ = new seal::BatchEncoder(*context_);
-    keygen_ = new seal::KeyGenerator(*context_);
+    crypto_ = crypto ? crypto : make_crypto_context(pir_params.get_seal_parameters());
+    context_ = &crypto_->get_context();
+    batch_encoder_ = &crypto_->get_batch_encoder();
+    evaluator_ = &crypto_->get_evaluator();
+    response_codec_ = ResponseCodec(*context_);
+    keygen_ = std::make_shared<seal::KeyGenerator>(*context_);
     secret_key_ = keygen_->secret_key();
-    encryptor_ = new seal::Encryptor(*context_, secret_key_);
-    decryptor_ = new seal::Decryptor(*context_, secret_key_);
-    // setting client's public keys
-    keygen_->create_galois_keys(gal_keys_);
-    keygen_->create_relin_keys(relin_keys_);
+    encryptor_ = std::make_shared<seal::Encryptor>(*context_, secret_key_);
+    decryptor_ = std::make_shared<seal::Decryptor>(*context_, secret_key_);
+    // setting client's public keys, only for the rotations the server performs
+    keygen_->create_galois_keys(pir_params_.get_rotation_steps(), public_keys_.first);
+    keygen_->create_relin_keys(public_keys_.second);
 
     plaint_bit_count_ = pir_params_.get_seal_parameters().plain_modulus().bit_count();
     polynomial_degree_ = pir_params_.get_seal_parameters().poly_modulus_degree();
@@ -22,18 +25,19 @@ Client::Client(PirParams &pir_params) : pir_params_(pir_params)
     num_databases_ = pir_params_.get_db_count();
 }
 
-Client::Client(PirParams &pir_params, seal::KeyGenerator *keygen) : pir_params_(pir_params)
+Client::Client(PirParams &pir_params, std::shared_ptr<seal::KeyGenerator> keygen, CryptoContextPtr crypto) : pir_params_(pir_params)
 {
 
-    context_ = new seal::SEALContext(pir_params.get_seal_parameters());
-    batch_encoder_ = new seal::BatchEncoder(*context_);
+    crypto_ = crypto ? crypto : make_crypto_context(pir_params.get_seal_parameters());
+    context_ = &crypto_->get_context();
+    batch_encoder_ = &crypto_->get_batch_encoder();
+    evaluator_ = &crypto_->get_evaluator();
+    response_codec_ = ResponseCodec(*context_);
     keygen_ = keygen;
     secret_key_ = keygen_->secret_key();
-    encryptor_ = new seal::Encryptor(*context_, secret_key_);
-    decryptor_ = new seal::Decryptor(*context_, secret_key_);
-    // setting client's public keys
-    keygen_->create_galois_keys(gal_keys_);
-    keygen_->create_relin_keys(relin_keys_);
+    encryptor_ = std::make_shared<seal::Encryptor>(*context_, secret_key_);
+    decryptor_ = std::make_shared<seal::Decryptor>(*context_, secret_key_);
+    // the public keys were generated by the client that owns keygen
 
     plaint_bit_count_ = pir_params_.get_seal_parameters().plain_modulus().bit_count();
     polynomial_degree_ = pir_params_.get_seal_parameters().poly_modulus_degree();
@@ -43,28 +47,47 @@ Client::Client(PirParams &pir_params, seal::KeyGenerator *keygen) : pir_params_(
     num_databases_ = pir_params_.get_db_count();
 }
 
-seal::KeyGenerator *Client::get_keygen()
+std::shared_ptr<seal::KeyGenerator> Client::get_keygen()
 {
     return keygen_;
 }
 
-std::pair<seal::GaloisKeys, seal::RelinKeys> Client::get_public_keys()
+const ClientKeys &Client::get_public_keys() const
 {
-    if (gal_keys_.size() == 0 || relin_keys_.size() == 0)
+    if (public_keys_.first.size() == 0 || public_keys_.second.size() == 0)
     {
         std::cerr << "Error: Public keys are not initialized!" << std::endl;
         throw std::runtime_error("Error: Keys are not initialized!");
     }
-    return std::make_pair(gal_keys_, relin_keys_);
-    ;
+    return public_keys_;
 }
 
-vector<uint64_t> Client::get_entry_list()
+PIRResponseList Client::decompress_responses(const CompressedResponseList &responses) const
+{
+    PIRResponseList list;
+    list.reserve(responses.size());
+    for (const auto &response : responses)
+    {
+        list.push_back(response_codec_.decompress(response));
+    }
+    return list;
+}
+
+const vector<uint64_t> &Client::get_entry_list() const
 {
     return entry_slot_list_;
 }
 
-std::vector<unsigned char> Client::decode_response(PIRResponseList response)
+void Client::set_entry_list(vector<uint64_t> entry_slot_list)
+{
+    if (entry_slot_list.size() != num_databases_)
+    {
+        throw std::invalid_argument("Error: size of the entry list should be equal to num_databases_");
+    }
+    entry_slot_list_ = std::move(entry_slot_list);
+}
+
+std::vector<unsigned char> Client::decode_response(const PIRResponseList &response)
 {
 
     check_noise_budget(response[0]);
@@ -96,7 +119,7 @@ void Client::check_noise_budget(const seal::Ciphertext& response) {
 }
 
 
-vector<RawResponses> Client::decode_merged_responses(PIRResponseList response, size_t cuckoo_size, vector<vector<uint64_t>> entry_slot_lists)
+vector<RawResponses> Client::decode_merged_responses(const PIRResponseList &response, size_t cuckoo_size, const vector<vector<uint64_t>> &entry_slot_lists)
 {
     check_noise_budget(response[0]);
     const size_t num_slots_per_entry = pir_params_.get_num_slots_per_entry();
@@ -178,7 +201,7 @@ vector<RawResponses> Client::decode_merged_responses(PIRResponseList response, s
     return raw_entries_list;
 }
 
-std::vector<std::vector<unsigned char>> Client::single_pir_decode_responses(PIRResponseList response){
+std::vector<std::vector<unsigned char>> Client::single_pir_decode_responses(const PIRResponseList &response){
     auto noise_budget = decryptor_->invariant_noise_budget(response[0]);
     if (noise_budget == 0) {
         throw std::runtime_error("Error: noise budget is zero");
@@ -219,9 +242,18 @@ std::vector<std::vector<unsigned char>> Client::single_pir_decode_responses(PIRR
     return raw_entries;
 }
 
-RawResponses Client::decode_responses(PIRResponseList response)
+RawResponses Client::decode_responses(const PIRResponseList &response)
 {
-    check_noise_budget(response[0]);
+    return decode_responses(response.begin(), response.end());
+}
+
+RawResponses Client::decode_responses(PIRResponseList::const_iterator begin, PIRResponseList::const_iterator end)
+{
+    if (begin == end)
+    {
+        throw std::invalid_argument("Error: No responses to decode");
+    }
+    check_noise_budget(*begin);
 
     auto num_queries = num_databases_;
     seal::Plaintext pt;
@@ -232,10 +264,10 @@ RawResponses Client::decode_responses(PIRResponseList response)
     const size_t max_empty_slots = pir_params_.get_dimensions()[0];
     size_t remaining_slots_entry = num_columns_per_entry_;
 
-    for (int i = 0; i < response.size(); i++)
+    for (int i = 0; i < end - begin; i++)
     {
         decoded_response.clear();
-        decryptor_->decrypt(response[i], pt);
+        decryptor_->decrypt(begin[i], pt);
         batch_encoder_->decode(pt, decoded_response);
         uint32_t loop = std::min(max_empty_slots, remaining_slots_entry);
 
@@ -273,7 +305,7 @@ RawResponses Client::decode_responses(PIRResponseList response)
     return raw_entries;
 }
 
-RawResponses Client::decode_responses_chunks(PIRResponseList response)
+RawResponses Client::decode_responses_chunks(const PIRResponseList &response)
 {
     check_noise_budget(response[0]);
 
@@ -322,7 +354,7 @@ RawResponses Client::decode_responses_chunks(PIRResponseList response)
     return raw_entries;
 }
 
-std::vector<unsigned char> Client::convert_to_rawdb_entry(std::vector<uint64_t> input_list)
+std::vector<unsigned char> Client::convert_to_rawdb_entry(const std::vector<uint64_t> &input_list)
 {
     auto size_of_input = input_list.size();
     const int size_of_coeff = plaint_bit_count_ - 1;
@@ -349,7 +381,7 @@ std::vector<unsigned char> Client::convert_to_rawdb_entry(std::vector<uint64_t>
     return res;
 }
 
-PIRQuery Client::gen_query(vector<uint64_t> indices)
+PIRQuery Client::gen_query(const vector<uint64_t> &indices)
 {
 
     if (indices.size() != num_databases_)
@@ -382,10 +414,10 @@ PIRQuery Client::gen_query(vector<uint64_t> indices)
 
         // saving first chunk location to be used for decoding at the end
         entry_slot_list_[i] = current_slot;
-        plain_queries[i] = plain_query;
+        plain_queries[i] = std::move(plain_query);
     }
 
-    return merge_pir_queries(plain_queries);
+    return merge_pir_queries(std::move(plain_queries));
 }
 
 PIRQuery Client::merge_pir_queries(vector<PirDB> plain_queries)
@@ -397,7 +429,6 @@ PIRQuery Client::merge_pir_queries(vector<PirDB> plain_queries)
 
     // Initialize the plaintext and the plain query matrix
     seal::Plaintext pt;
-    seal::Ciphertext ct;
     PirDB merged_plain_query(pir_dimensions.size(), std::vector<uint64_t>(polynomial_degree_, 0ULL));
 
     for (int j = 0; j < pir_dimensions.size(); j++)
@@ -419,13 +450,44 @@ PIRQuery Client::merge_pir_queries(vector<PirDB> plain_queries)
         }
 
         batch_encoder_->encode(merged_plain_query[j], pt);
-        encryptor_->encrypt_symmetric(pt, ct);
-        merged_query.push_back(ct);
+        // encrypt straight into the query instead of copying a temporary
+        merged_query.emplace_back();
+        encrypt_query_part(pt, merged_query.back());
     }
 
     return merged_query;
 }
 
+void Client::precompute_queries(size_t num_queries)
+{
+    const size_t num_parts = num_queries * pir_params_.get_dimensions().size();
+    precomputed_zeros_.reserve(precomputed_zeros_.size() + num_parts);
+    for (size_t i = 0; i < num_parts; i++)
+    {
+        precomputed_zeros_.emplace_back();
+        encryptor_->encrypt_zero_symmetric(precomputed_zeros_.back());
+    }
+}
+
+size_t Client::get_num_precomputed_queries() const
+{
+    return precomputed_zeros_.size() / pir_params_.get_dimensions().size();
+}
+
+void Client::encrypt_query_part(const seal::Plaintext &pt, seal::Ciphertext &destination)
+{
+    if (precomputed_zeros_.empty())
+    {
+        encryptor_->encrypt_symmetric(pt, destination);
+        return;
+    }
+
+    // Enc(0) + pt is distributed like Enc(pt), the BFV scaling happens in add_plain
+    destination = std::move(precomputed_zeros_.back());
+    precomputed_zeros_.pop_back();
+    evaluator_->add_plain_inplace(destination, pt);
+}
+
 PIRQuery Client::gen_query(uint64_t index)
 {
     // Compute the indices for each dimension
@@ -443,7 +505,6 @@ PIRQuery Client::gen_query(uint64_t index)
 
     // Initialize the plaintext and the plain query matrix
     seal::Plaintext pt;
-    seal::Ciphertext ct;
     std::vector<std::vector<uint64_t>> plain_query(pir_dimensions.size(), std::vector<uint64_t>(polynomial_degree_, 0ULL));
 
     // Construct the query matrix
@@ -469,8 +530,8 @@ PIRQuery Client::gen_query(uint64_t index)
 
         // Encrypt the plain query and add it to the query object
         batch_encoder_->encode(plain_query[i], pt);
-        encryptor_->encrypt_symmetric(pt, ct);
-        query.push_back(ct);
+        query.emplace_back();
+        encrypt_query_part(pt, query.back());
     }
 
     // Saving the expected slot for entry
@@ -0,0 +1,21 @@
+#include "cryptocontext.h"
+
+CryptoContext::CryptoContext(const seal::EncryptionParameters &seal_params)
+    : context_(seal_params), evaluator_(context_), batch_encoder_(context_)
+{
+}
+
+const seal::SEALContext &CryptoContext::get_context() const
+{
+    return context_;
+}
+
+const seal::Evaluator &CryptoContext::get_evaluator() const
+{
+    return evaluator_;
+}
+
+const seal::BatchEncoder &CryptoContext::get_batch_encoder() const
+{
+    return batch_encoder_;
+}
@@ -3,6 +3,7 @@
 #include <cassert>
 #include <chrono>
 #include <functional>
+#include <memory>
 #include "server.h"
 #include "pirparams.h"
 #include "client.h"
@@ -16,6 +17,7 @@ using namespace chrono;
 void print_usage()
 {
     std::cout << "Usage: vectorized_batch_pir -n <db_entries> -s <entry_size>\n";
+    std::cout << "       vectorized_batch_pir -batchpir\n";
 }
 
 // 校验命令行参数，确保输入的数据库条目数和条目大小有效
@@ -163,14 +165,42 @@ int batchpir_main(int argc, char *argv[])
     // 定义输入选择，包含批量大小、条目数量和条目大小
     std::vector<std::array<size_t, 3>> input_choices;
     input_choices.push_back({32, 1048576, 32});
-    // input_choices.push_back({64, 1048576, 32});
-    // input_choices.push_back({256, 1048576, 32});
 
     // 用于记录不同阶段的时间
     std::vector<std::chrono::milliseconds> init_times;
+    std::vector<std::chrono::milliseconds> query_precompute_times;
     std::vector<std::chrono::milliseconds> query_gen_times;
     std::vector<std::chrono::milliseconds> resp_gen_times;
     std::vector<size_t> communication_list;
+    std::vector<std::array<double, 4>> stage_times;
+    std::vector<std::chrono::milliseconds> concurrent_resp_times;
+    std::vector<size_t> init_rss;
+    std::vector<size_t> init_rss_growth;
+    std::vector<size_t> num_servers;
+    std::vector<std::pair<size_t, size_t>> concurrent_alloc_bytes;
+    std::vector<std::vector<std::pair<size_t, double>>> batched_resp_times;
+
+    // -lazy: 第二维累积未重线性化的乘积，每个输出只重线性化一次
+    // -clients <n>: 额外用 n 个客户端并发请求，测试多客户端吞吐量
+    // -keycmp: 同时生成 SEAL 默认的 Galois 密钥，比较密钥大小
+    // -many: 另外测试批大小 64 和 256，分桶更多，子服务器更多
+    bool lazy_relin = false;
+    bool compare_keys = false;
+    size_t num_clients = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "-lazy")
+            lazy_relin = true;
+        else if (string(argv[i]) == "-keycmp")
+            compare_keys = true;
+        else if (string(argv[i]) == "-many")
+        {
+            input_choices.push_back({64, 1048576, 32});
+            input_choices.push_back({256, 1048576, 32});
+        }
+        else if (string(argv[i]) == "-clients" && i + 1 < argc)
+            num_clients = std::max(1, std::atoi(argv[++i]));
+    }
 
     // 遍历每种输入选择
     for (size_t iteration = 0; iteration < input_choices.size(); ++iteration)
@@ -189,21 +219,48 @@ int batchpir_main(int argc, char *argv[])
         BatchPirParams params(choice[0], choice[1], choice[2], encryption_params);
         params.print_params();
 
-        // 记录初始化时间
+        // 随机生成数据库条目
+        std::vector<uint8_t> db_entries(choice[1] * choice[2]);
+        for (auto &byte : db_entries)
+        {
+            byte = rand() % 0xFF;
+        }
+
+        // 记录初始化时间（分桶、编码和 NTT 预处理）以及峰值内存
+        auto rss_before = utils::get_current_rss_kb();
         auto start = chrono::high_resolution_clock::now();
         BatchPIRServer batch_server(params);
+        batch_server.set_lazy_relinearization(lazy_relin);
+        batch_server.setEntries(db_entries.data());
         auto end = chrono::high_resolution_clock::now();
         auto duration_init = chrono::duration_cast<chrono::milliseconds>(end - start);
         init_times.push_back(duration_init);
+        init_rss.push_back(utils::get_peak_rss_kb());
+        auto rss_after = utils::get_current_rss_kb();
+        init_rss_growth.push_back(rss_after > rss_before ? rss_after - rss_before : 0);
+        num_servers.push_back(batch_server.get_num_servers());
 
-        BatchPIRClient batch_client(params);
+        // 客户端使用服务器填充数据库后的参数（包含最大桶大小）
+        BatchPIRClient batch_client(batch_server.get_params());
 
         // 获取服务器的哈希映射并设置给客户端
-        auto map = batch_server.get_hash_map();
+        const auto &map = batch_server.get_hash_map();
         batch_client.set_map(map);
 
-        // 设置客户端密钥
-        batch_server.set_client_keys(client_id, batch_client.get_public_keys());
+        // 设置客户端密钥，密钥只在服务器端保存一份，由所有子服务器共享
+        const auto &public_keys = batch_client.get_public_keys();
+        cout << "Main: Public keys size: " << (public_keys.first.save_size() + public_keys.second.save_size()) / 1024 << " KB"
+             << " (" << public_keys.first.size() << " Galois keys, " << public_keys.first.save_size() / 1024 << " KB)" << endl;
+        if (compare_keys)
+        {
+            // SEAL 默认的 Galois 密钥集合（所有 +-2^i 步和列旋转），用于比较密钥大小
+            seal::KeyGenerator keygen(batch_client.get_context());
+            seal::GaloisKeys default_keys;
+            keygen.create_galois_keys(default_keys);
+            cout << "Main: SEAL default Galois keys: " << default_keys.size() << " keys, "
+                 << default_keys.save_size() / 1024 << " KB" << endl;
+        }
+        batch_server.set_client_keys(client_id, public_keys);
 
         // 随机生成条目索引
         vector<uint64_t> entry_indices;
@@ -212,6 +269,12 @@ int batchpir_main(int argc, char *argv[])
             entry_indices.push_back(rand() % choice[2]);
         }
 
+        // 离线阶段：预先加密零，在线生成查询时只需编码并相加
+        start = chrono::high_resolution_clock::now();
+        batch_client.precompute_queries(1);
+        end = chrono::high_resolution_clock::now();
+        query_precompute_times.push_back(chrono::duration_cast<chrono::milliseconds>(end - start));
+
         // 生成查询并记录时间
         cout << "Main: Starting query generation for example " << (iteration + 1) << "..." << endl;
         start = chrono::high_resolution_clock::now();
@@ -224,15 +287,17 @@ int batchpir_main(int argc, char *argv[])
         // 生成响应并记录时间
         cout << "Main: Starting response generation for example " << (iteration + 1) << "..." << endl;
         start = chrono::high_resolution_clock::now();
-        PIRResponseList responses = batch_server.generate_response(client_id, queries);
+        // 响应经过模切换和低位截断后按位打包
+        CompressedResponseList responses = batch_server.generate_compressed_response(client_id, queries);
         end = chrono::high_resolution_clock::now();
         auto duration_respgen = chrono::duration_cast<chrono::milliseconds>(end - start);
         resp_gen_times.push_back(duration_respgen);
+        stage_times.push_back(batch_server.get_stage_times());
         cout << "Main: Response generation complete for example " << (iteration + 1) << "." << std::endl;
 
         // 检查解码后的条目是否匹配
         cout << "Main: Checking decoded entries for example " << (iteration + 1) << "..." << endl;
-        auto decode_responses = batch_client.decode_responses_chunks(responses);
+        auto decode_responses = batch_client.decode_compressed_responses(responses);
 
         // 记录通信数据大小
         communication_list.push_back(batch_client.get_serialized_commm_size());
@@ -244,6 +309,67 @@ int batchpir_main(int argc, char *argv[])
             cout << "Main: All the entries matched for example " << (iteration + 1) << "!!" << std::endl;
         }
 
+        // 多个客户端的请求并发处理，服务器数据库只读共享
+        if (num_clients > 1)
+        {
+            std::vector<std::unique_ptr<BatchPIRClient>> clients;
+            std::vector<uint32_t> client_ids;
+            std::vector<std::vector<PIRQuery>> client_queries;
+            for (size_t c = 0; c < num_clients; c++)
+            {
+                clients.push_back(std::unique_ptr<BatchPIRClient>(new BatchPIRClient(batch_server.get_params())));
+                clients[c]->set_map(map);
+                client_ids.push_back(client_id + 1 + c);
+                batch_server.set_client_keys(client_ids[c], clients[c]->get_public_keys());
+                client_queries.push_back(clients[c]->create_queries(entry_indices));
+            }
+
+            cout << "Main: Answering " << num_clients << " clients concurrently..." << endl;
+            // 每个线程使用独立的内存池，统计线程内存池和全局内存池的分配量
+            size_t pool_alloc_bytes = 0;
+            size_t global_alloc_bytes = seal::MemoryManager::GetPool().alloc_byte_count();
+            start = chrono::high_resolution_clock::now();
+            auto client_responses = batch_server.generate_responses(client_ids, client_queries, num_clients, &pool_alloc_bytes);
+            end = chrono::high_resolution_clock::now();
+            concurrent_resp_times.push_back(chrono::duration_cast<chrono::milliseconds>(end - start));
+            global_alloc_bytes = seal::MemoryManager::GetPool().alloc_byte_count() - global_alloc_bytes;
+            concurrent_alloc_bytes.push_back({pool_alloc_bytes, global_alloc_bytes});
+
+            for (size_t c = 0; c < num_clients; c++)
+            {
+                auto entries = clients[c]->decode_responses_chunks(client_responses[c]);
+                batch_server.check_decoded_entries(entries, clients[c]->get_cuckoo_table());
+            }
+
+            // 批量模式：每次扫描数据库同时服务多个查询，比较不同批大小下每个查询的耗时。
+            // 批大小为 1, 2, 4, ... 以及 num_clients 本身；与并发模式使用相同的线程数，各 PIR 服务器分到不同线程
+            std::vector<size_t> batch_sizes;
+            for (size_t batch = 1; batch < num_clients; batch *= 2)
+            {
+                batch_sizes.push_back(batch);
+            }
+            batch_sizes.push_back(num_clients);
+
+            std::vector<std::pair<size_t, double>> batch_times;
+            for (auto batch : batch_sizes)
+            {
+                std::vector<uint32_t> batch_ids(client_ids.begin(), client_ids.begin() + batch);
+                std::vector<std::vector<PIRQuery>> batch_queries(client_queries.begin(), client_queries.begin() + batch);
+
+                start = chrono::high_resolution_clock::now();
+                auto batch_responses = batch_server.generate_batched_responses(batch_ids, batch_queries, num_clients);
+                end = chrono::high_resolution_clock::now();
+                batch_times.push_back({batch, chrono::duration<double, std::milli>(end - start).count() / batch});
+
+                for (size_t c = 0; c < batch; c++)
+                {
+                    auto entries = clients[c]->decode_responses_chunks(batch_responses[c]);
+                    batch_server.check_decoded_entries(entries, clients[c]->get_cuckoo_table());
+                }
+            }
+            batched_resp_times.push_back(batch_times);
+        }
+
         cout << std::endl;
     }
 
@@ -259,8 +385,28 @@ int batchpir_main(int argc, char *argv[])
         cout << "Entry Size: " << input_choices[i][2] << std::endl;
 
         cout << "Initialization time: " << init_times[i].count() << " milliseconds" << std::endl;
-        cout << "Query generation time: " << query_gen_times[i].count() << " milliseconds" << std::endl;
+        cout << "PIR servers: " << num_servers[i] << std::endl;
+        cout << "Peak RSS after initialization: " << init_rss[i] / 1024 << " MB, grown by "
+             << init_rss_growth[i] / 1024 << " MB during initialization" << std::endl;
+        cout << "Query precomputation time (offline): " << query_precompute_times[i].count() << " milliseconds" << std::endl;
+        cout << "Query generation time (online): " << query_gen_times[i].count() << " milliseconds" << std::endl;
         cout << "Response generation time: " << resp_gen_times[i].count() << " milliseconds" << std::endl;
+        cout << "  first dimension: " << stage_times[i][0] << " ms, second dimension: " << stage_times[i][1]
+             << " ms, last dimension: " << stage_times[i][2] << " ms, merge: " << stage_times[i][3]
+             << " ms" << (lazy_relin ? " (lazy relinearization)" : "") << std::endl;
+        if (num_clients > 1)
+        {
+            cout << "Concurrent response generation for " << num_clients << " clients on " << num_clients << " threads: " << concurrent_resp_times[i].count()
+                 << " milliseconds (" << num_clients * 1000.0 / std::max<int64_t>(1, concurrent_resp_times[i].count())
+                 << " requests/s)" << std::endl;
+            cout << "  allocated by thread pools: " << concurrent_alloc_bytes[i].first / 1024
+                 << " KB, by the global pool: " << concurrent_alloc_bytes[i].second / 1024 << " KB" << std::endl;
+            for (auto &batch_time : batched_resp_times[i])
+            {
+                cout << "  batched on " << num_clients << " threads, " << batch_time.first << " clients per database scan: " << batch_time.second
+                     << " ms per request (" << 1000.0 / batch_time.second << " requests/s)" << std::endl;
+            }
+        }
         cout << "Total communication: " << communication_list[i] << " KB" << std::endl;
         cout << std::endl;
     }
@@ -270,9 +416,9 @@ int batchpir_main(int argc, char *argv[])
 
 int main(int argc, char *argv[])
 {
-    // 调用 batchpir_main 函数
-    // vectorized_pir_main(argc, argv);
-    // batchpir_main(argc, argv);
+    // -batchpir 运行批量 PIR 基准测试，其余参数见 batchpir_main；否则运行向量化 PIR
+    if (argc > 1 && string(argv[1]) == "-batchpir")
+        return batchpir_main(argc, argv);
     vectorized_pir_main(argc, argv);
     return 0;
 }
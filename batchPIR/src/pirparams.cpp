@@ -68,7 +68,32 @@ vector<size_t> PirParams::get_dimensions() const
     return dimensions_;
 }
 
-seal::EncryptionParameters PirParams::get_seal_parameters() const
+vector<int> PirParams::get_rotation_steps() const
+{
+    // The server only rotates rows by negative multiples of gap = row_size / dimensions_[0]:
+    // rotate_copy_query and process_second_dimension use -i * gap for i < dimensions_[0],
+    // and the merge routines use -k * gap and -k * gap * slots_per_entry, which stay below
+    // row_size. Keys for +-gap * 2^j are enough: SEAL rotates by any other multiple of gap
+    // through its NAF decomposition, whose terms are +-gap * 2^j (a term of row_size is
+    // skipped). That is 2 * log2(dimensions_[0]) - 1 keys instead of one per multiple of gap.
+    // No step is hot enough yet to justify an extra single hop key.
+    const size_t row_size = seal_params_.poly_modulus_degree() / 2;
+    const size_t gap = row_size / dimensions_[0];
+
+    vector<int> steps;
+    for (size_t step = gap; step < row_size; step *= 2)
+    {
+        steps.push_back(-1 * static_cast<int>(step));
+        // rotating by +-row_size / 2 is the same Galois element
+        if (2 * step != row_size)
+        {
+            steps.push_back(static_cast<int>(step));
+        }
+    }
+    return steps;
+}
+
+const seal::EncryptionParameters &PirParams::get_seal_parameters() const
 {
     return seal_params_;
 }
@@ -0,0 +1,284 @@
+#include "responsecodec.h"
+
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+    typedef unsigned __int128 uint128_t;
+
+    size_t bit_length(uint128_t x)
+    {
+        size_t n = 0;
+        while (x)
+        {
+            x >>= 1;
+            n++;
+        }
+        return n;
+    }
+
+    uint64_t mul_mod(uint64_t a, uint64_t b, uint64_t q)
+    {
+        return static_cast<uint64_t>((static_cast<uint128_t>(a) * b) % q);
+    }
+
+    uint64_t pow_mod(uint64_t a, uint64_t e, uint64_t q)
+    {
+        uint64_t r = 1;
+        a %= q;
+        while (e)
+        {
+            if (e & 1)
+                r = mul_mod(r, a, q);
+            a = mul_mod(a, a, q);
+            e >>= 1;
+        }
+        return r;
+    }
+
+    // Appends fixed width values to a little endian bit stream.
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(vector<uint8_t> &out) : out_(out) {}
+
+        void write(uint128_t value, size_t width)
+        {
+            for (size_t i = 0; i < width;)
+            {
+                if (bit_pos_ == 0)
+                    out_.push_back(0);
+                size_t take = std::min<size_t>(8 - bit_pos_, width - i);
+                out_.back() |= static_cast<uint8_t>(((value >> i) & ((1u << take) - 1)) << bit_pos_);
+                bit_pos_ = (bit_pos_ + take) % 8;
+                i += take;
+            }
+        }
+
+    private:
+        vector<uint8_t> &out_;
+        size_t bit_pos_ = 0;
+    };
+
+    class BitReader
+    {
+    public:
+        BitReader(const uint8_t *data, size_t size) : data_(data), size_(size) {}
+
+        uint128_t read(size_t width)
+        {
+            uint128_t value = 0;
+            for (size_t i = 0; i < width;)
+            {
+                if (pos_ / 8 >= size_)
+                    throw std::invalid_argument("Error: Compressed response is truncated");
+                size_t bit = pos_ % 8;
+                size_t take = std::min<size_t>(8 - bit, width - i);
+                uint128_t chunk = (data_[pos_ / 8] >> bit) & ((1u << take) - 1);
+                value |= chunk << i;
+                pos_ += take;
+                i += take;
+            }
+            return value;
+        }
+
+    private:
+        const uint8_t *data_;
+        size_t size_;
+        size_t pos_ = 0;
+    };
+}
+
+size_t ResponseCodec::Layout::coeff_bits(size_t poly) const
+{
+    if (composed)
+        return widths[poly];
+
+    size_t bits = 0;
+    for (auto w : residue_widths)
+        bits += w;
+    return bits;
+}
+
+ResponseCodec::ResponseCodec(const seal::SEALContext &context, size_t noise_margin_bits)
+    : context_(&context)
+{
+    auto first = context.first_context_data();
+    poly_degree_ = first->parms().poly_modulus_degree();
+    const double t_bits = first->parms().plain_modulus().bit_count();
+    const double log_n = std::log2(static_cast<double>(poly_degree_));
+    const double margin = static_cast<double>(noise_margin_bits);
+
+    layouts_.resize(first->chain_index() + 1);
+    response_chain_index_ = first->chain_index();
+
+    for (auto data = first; data; data = data->next_context_data())
+    {
+        Layout layout;
+        layout.parms_id = data->parms_id();
+
+        // log2 of a lower bound on q, every prime q_i is at least 2^(bits - 1)
+        double log_q = 0;
+        for (auto &modulus : data->parms().coeff_modulus())
+        {
+            layout.primes.push_back(modulus.value());
+            layout.residue_widths.push_back(modulus.bit_count());
+            log_q += modulus.bit_count() - 1;
+        }
+
+        // Switching to q adds at most (t / q) * (1 + N) / 2 to the invariant noise.
+        // Use the lowest level where this stays below 2^-(margin + 2).
+        if (log_q >= t_bits + std::log2(poly_degree_ + 1.0) - 1 + margin + 2)
+        {
+            response_chain_index_ = data->chain_index();
+        }
+
+        // Rounding away d bits of c0 adds at most (t / q) * 2^(d - 1), of c1 at most
+        // (t / q) * N * 2^(d - 1). Each share is kept below 2^-(margin + 3).
+        // Reconstructing the coefficient needs 128 bit arithmetic, so this is limited
+        // to at most two primes.
+        size_t total_bits = 0;
+        for (auto w : layout.residue_widths)
+            total_bits += w;
+        if (layout.primes.size() <= 2 && total_bits <= 126)
+        {
+            layout.composed = true;
+            uint128_t q = layout.primes[0];
+            if (layout.primes.size() == 2)
+            {
+                q *= layout.primes[1];
+                layout.q0_inv_mod_q1 = pow_mod(layout.primes[0], layout.primes[1] - 2, layout.primes[1]);
+            }
+
+            double d0 = std::floor(log_q - t_bits - margin - 2);
+            double d1 = std::floor(log_q - t_bits - log_n - margin - 2);
+            layout.dropped_bits[0] = d0 > 0 ? static_cast<size_t>(d0) : 0;
+            layout.dropped_bits[1] = d1 > 0 ? static_cast<size_t>(d1) : 0;
+
+            for (size_t poly = 0; poly < 2; poly++)
+            {
+                auto d = layout.dropped_bits[poly];
+                uint128_t half = d ? static_cast<uint128_t>(1) << (d - 1) : 0;
+                layout.widths[poly] = bit_length((q - 1 + half) >> d);
+            }
+        }
+
+        layouts_[data->chain_index()] = layout;
+    }
+}
+
+const ResponseCodec::Layout &ResponseCodec::layout_of(size_t chain_index) const
+{
+    if (chain_index >= layouts_.size() || layouts_[chain_index].primes.empty())
+        throw std::invalid_argument("Error: Response is not at a data level");
+    return layouts_[chain_index];
+}
+
+seal::parms_id_type ResponseCodec::get_response_parms_id() const
+{
+    return layout_of(response_chain_index_).parms_id;
+}
+
+void ResponseCodec::mod_switch(const seal::Evaluator &evaluator, seal::Ciphertext &ct, seal::MemoryPoolHandle pool) const
+{
+    auto chain_index = context_->get_context_data(ct.parms_id())->chain_index();
+    if (chain_index > response_chain_index_)
+    {
+        evaluator.mod_switch_to_inplace(ct, get_response_parms_id(), pool);
+    }
+}
+
+size_t ResponseCodec::compressed_size() const
+{
+    auto &layout = layout_of(response_chain_index_);
+    return 1 + (poly_degree_ * (layout.coeff_bits(0) + layout.coeff_bits(1)) + 7) / 8;
+}
+
+CompressedResponse ResponseCodec::compress(const seal::Ciphertext &ct) const
+{
+    if (ct.size() != 2 || ct.is_ntt_form())
+        throw std::invalid_argument("Error: Only relinearized, non-NTT responses can be compressed");
+
+    auto chain_index = context_->get_context_data(ct.parms_id())->chain_index();
+    auto &layout = layout_of(chain_index);
+    const size_t num_primes = layout.primes.size();
+
+    CompressedResponse out;
+    out.reserve(1 + (poly_degree_ * (layout.coeff_bits(0) + layout.coeff_bits(1)) + 7) / 8);
+    out.push_back(static_cast<uint8_t>(chain_index));
+
+    BitWriter writer(out);
+    for (size_t poly = 0; poly < 2; poly++)
+    {
+        const uint64_t *data = ct.data(poly);
+        for (size_t k = 0; k < poly_degree_; k++)
+        {
+            if (layout.composed)
+            {
+                // Garner: c = a0 + q0 * ((a1 - a0) / q0 mod q1)
+                uint128_t c = data[k];
+                if (num_primes == 2)
+                {
+                    auto q0 = layout.primes[0], q1 = layout.primes[1];
+                    uint64_t a0 = data[k], a1 = data[poly_degree_ + k];
+                    uint64_t diff = (a1 + q1 - a0 % q1) % q1;
+                    c = a0 + static_cast<uint128_t>(q0) * mul_mod(diff, layout.q0_inv_mod_q1, q1);
+                }
+
+                auto d = layout.dropped_bits[poly];
+                uint128_t half = d ? static_cast<uint128_t>(1) << (d - 1) : 0;
+                writer.write((c + half) >> d, layout.widths[poly]);
+            }
+            else
+            {
+                for (size_t j = 0; j < num_primes; j++)
+                {
+                    writer.write(data[j * poly_degree_ + k], layout.residue_widths[j]);
+                }
+            }
+        }
+    }
+    return out;
+}
+
+seal::Ciphertext ResponseCodec::decompress(const CompressedResponse &data) const
+{
+    if (data.empty())
+        throw std::invalid_argument("Error: Compressed response is empty");
+
+    auto &layout = layout_of(data[0]);
+    const size_t num_primes = layout.primes.size();
+
+    seal::Ciphertext ct(*context_, layout.parms_id);
+    ct.resize(*context_, layout.parms_id, 2);
+
+    uint128_t q = layout.primes[0];
+    if (num_primes == 2)
+        q *= layout.primes[1];
+
+    BitReader reader(data.data() + 1, data.size() - 1);
+    for (size_t poly = 0; poly < 2; poly++)
+    {
+        uint64_t *out = ct.data(poly);
+        for (size_t k = 0; k < poly_degree_; k++)
+        {
+            if (layout.composed)
+            {
+                uint128_t c = (reader.read(layout.widths[poly]) << layout.dropped_bits[poly]) % q;
+                for (size_t j = 0; j < num_primes; j++)
+                {
+                    out[j * poly_degree_ + k] = static_cast<uint64_t>(c % layout.primes[j]);
+                }
+            }
+            else
+            {
+                for (size_t j = 0; j < num_primes; j++)
+                {
+                    out[j * poly_degree_ + k] = static_cast<uint64_t>(reader.read(layout.residue_widths[j]));
+                }
+            }
+        }
+    }
+    return ct;
+}
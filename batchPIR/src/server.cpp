@@ -1,11 +1,16 @@
 #include "server.h"
 
+// Coefficients per tile of the batched first dimension, a multiple of 32
+static const size_t FirstDimensionTileCoeffs = 1024;
+
 // Constructor
-Server::Server(PirParams &pir_params) : pir_params_(pir_params)
+Server::Server(PirParams &pir_params, CryptoContextPtr crypto) : pir_params_(pir_params)
 {
-    context_ = new seal::SEALContext(pir_params.get_seal_parameters());
-    evaluator_ = new seal::Evaluator(*context_);
-    batch_encoder_ = new seal::BatchEncoder(*context_);
+    crypto_ = crypto ? crypto : make_crypto_context(pir_params.get_seal_parameters());
+    context_ = &crypto_->get_context();
+    evaluator_ = &crypto_->get_evaluator();
+    batch_encoder_ = &crypto_->get_batch_encoder();
+    response_codec_ = ResponseCodec(*context_);
     plaint_bit_count_ = pir_params_.get_seal_parameters().plain_modulus().bit_count();
     polynomial_degree_ = pir_params_.get_seal_parameters().poly_modulus_degree();
     pir_dimensions_ = pir_params_.get_dimensions();
@@ -14,13 +19,16 @@ Server::Server(PirParams &pir_params) : pir_params_(pir_params)
     num_databases_ = pir_params_.get_db_count();
     is_db_preprocessed_ = false;
     is_client_keys_set_ = false;
+    prepare_selection_masks();
 }
 
-Server::Server(PirParams &pir_params, vector<RawDB> sub_buckets) : pir_params_(pir_params)
+Server::Server(PirParams &pir_params, vector<RawDB> &&sub_buckets, CryptoContextPtr crypto) : pir_params_(pir_params)
 {
-    context_ = new seal::SEALContext(pir_params.get_seal_parameters());
-    evaluator_ = new seal::Evaluator(*context_);
-    batch_encoder_ = new seal::BatchEncoder(*context_);
+    crypto_ = crypto ? crypto : make_crypto_context(pir_params.get_seal_parameters());
+    context_ = &crypto_->get_context();
+    evaluator_ = &crypto_->get_evaluator();
+    batch_encoder_ = &crypto_->get_batch_encoder();
+    response_codec_ = ResponseCodec(*context_);
     plaint_bit_count_ = pir_params_.get_seal_parameters().plain_modulus().bit_count();
     polynomial_degree_ = pir_params_.get_seal_parameters().poly_modulus_degree();
     pir_dimensions_ = pir_params_.get_dimensions();
@@ -29,18 +37,93 @@ Server::Server(PirParams &pir_params, vector<RawDB> sub_buckets) : pir_params_(p
     num_databases_ = pir_params_.get_db_count();
     is_db_preprocessed_ = false;
     is_client_keys_set_ = false;
-    rawdb_list_ = sub_buckets;
+    prepare_selection_masks();
+    rawdb_list_ = std::move(sub_buckets);
     round_dbs();
     convert_merge_pir_dbs();
     ntt_preprocess_db();
 }
 
-void Server::set_client_keys(uint32_t client_id, std::pair<seal::GaloisKeys, seal::RelinKeys> keys)
+void Server::prepare_selection_masks()
+{
+    // the responses are one level down after a third dimension, otherwise at the first level
+    auto response_context = context_->first_context_data();
+    if (pir_dimensions_.size() == 3 && response_context->next_context_data())
+    {
+        response_context = response_context->next_context_data();
+    }
+    response_parms_id_ = response_context->parms_id();
+
+    const size_t num_slots_per_entry_rounded = utils::next_power_of_two(pir_params_.get_num_slots_per_entry());
+    const size_t chunk_fill = gap_ * num_slots_per_entry_rounded;
+
+    chunk_selection_masks_.clear();
+    for (size_t j = 0; chunk_fill <= row_size_ && j < row_size_ / chunk_fill; j++)
+    {
+        chunk_selection_masks_.push_back(encode_selection_mask(j * chunk_fill, chunk_fill));
+    }
+
+    bucket_selection_masks_.clear();
+    for (size_t i = 0; i < row_size_ / gap_; i++)
+    {
+        bucket_selection_masks_.push_back(encode_selection_mask(i * gap_, gap_));
+    }
+}
+
+seal::Plaintext Server::encode_selection_mask(size_t begin, size_t width)
+{
+    // select slots [begin, begin + width) in both rows
+    std::vector<uint64_t> selection_vector(polynomial_degree_, 0ULL);
+    std::fill_n(selection_vector.begin() + begin, width, 1ULL);
+    std::fill_n(selection_vector.begin() + row_size_ + begin, width, 1ULL);
+
+    Plaintext pt;
+    batch_encoder_->encode(selection_vector, pt);
+    evaluator_->transform_to_ntt_inplace(pt, response_parms_id_);
+    return pt;
+}
+
+void Server::multiply_selection_mask(Ciphertext &ct, const seal::Plaintext &mask, seal::MemoryPoolHandle pool) const
+{
+    if (ct.parms_id() != mask.parms_id())
+    {
+        throw std::logic_error("Error: Response is not at the level of the selection masks");
+    }
+    // ct is left in NTT form, so that masked responses can be summed before transforming back
+    evaluator_->transform_to_ntt_inplace(ct);
+    evaluator_->multiply_plain_inplace(ct, mask, pool);
+}
+
+void Server::set_client_keys(uint32_t client_id, const ClientKeys &keys)
+{
+    set_client_keys(client_id, std::make_shared<const ClientKeys>(keys));
+}
+
+void Server::set_client_keys(uint32_t client_id, ClientKeys &&keys)
 {
-    client_keys_[client_id] = keys;
+    set_client_keys(client_id, std::make_shared<const ClientKeys>(std::move(keys)));
+}
+
+void Server::set_client_keys(uint32_t client_id, ClientKeysPtr keys)
+{
+    if (!keys)
+    {
+        throw std::invalid_argument("Error: Client keys are null");
+    }
+    client_keys_[client_id] = std::move(keys);
     is_client_keys_set_ = true;
 }
 
+const ClientKeys &Server::get_keys(uint32_t client_id) const
+{
+    auto it = client_keys_.find(client_id);
+    if (it == client_keys_.end())
+    {
+        throw std::invalid_argument("Error: No keys set for client " + to_string(client_id));
+    }
+    return *it->second;
+}
+
 void Server::get_client_keys()
 {
 
@@ -247,7 +330,7 @@ void Server::convert_merge_pir_dbs()
     for (int i = 0; i < num_databases_; i++)
     {
         auto db = convert_to_pir_db(i);
-        merge_to_db(db, i);
+        merge_to_db(std::move(db), i);
         std::cout << "BatchPIRServer: Processed database " << i + 1 << " of " << num_databases_ << "\r" << std::flush;
     }
 
@@ -355,8 +438,9 @@ void Server::transform_into_pir_db()
 
 // strategy which always merge chunks first
 
-PIRResponseList Server::merge_responses_chunks_buckets(vector<PIRResponseList> &responses, uint32_t client_id)
+PIRResponseList Server::merge_responses_chunks_buckets(vector<PIRResponseList> &responses, uint32_t client_id, seal::MemoryPoolHandle pool) const
 {
+    const auto &galois_keys = get_keys(client_id).first;
     const size_t num_slots_per_entry = pir_params_.get_num_slots_per_entry();
     const size_t num_slots_per_entry_rounded = utils::next_power_of_two(num_slots_per_entry);
 
@@ -377,14 +461,15 @@ PIRResponseList Server::merge_responses_chunks_buckets(vector<PIRResponseList> &
 
             // loop through chunks that can fit in a single ctxt
             uint32_t loop = std::min(max_empty_slots, remaining_slots_entry);
-            Ciphertext chunk_ct_acc = responses[i][chunk_idx];
+            Ciphertext chunk_ct_acc(pool);
+            chunk_ct_acc = responses[i][chunk_idx];
             for (size_t k = 1; k < loop; k++)
             {
-                evaluator_->rotate_rows_inplace(responses[i][chunk_idx + k], -1 * (k * gap_), client_keys_[client_id].first);
+                evaluator_->rotate_rows_inplace(responses[i][chunk_idx + k], -1 * (k * gap_), galois_keys, pool);
                 evaluator_->add_inplace(chunk_ct_acc, responses[i][chunk_idx + k]);
             }
             remaining_slots_entry -= loop;
-            chunk_response.push_back(chunk_ct_acc);
+            chunk_response.push_back(std::move(chunk_ct_acc));
         }
     }
 
@@ -397,7 +482,7 @@ PIRResponseList Server::merge_responses_chunks_buckets(vector<PIRResponseList> &
     // if remaining
     if (ceil(num_slots_per_entry * 1.0 / max_empty_slots) > 1 || num_buckets_merged <= 1 || chunk_response.size() == 1 )
     {
-        modulus_switch(chunk_response);
+        modulus_switch(chunk_response, pool);
         return chunk_response;
     }
 
@@ -407,27 +492,22 @@ PIRResponseList Server::merge_responses_chunks_buckets(vector<PIRResponseList> &
     PIRResponseList chunk_bucket_responses;
     for (int i = 0; i < merged_ctx_needed; i++)
     {
-        Ciphertext ct_acc;
+        Ciphertext ct_acc(pool);
         for (int j = 0; j < num_buckets_merged; j++)
         {
-            Ciphertext copy_ct_acc = chunk_response[i * num_buckets_merged + j];
-            Ciphertext tmp_ct = copy_ct_acc;
+            Ciphertext copy_ct_acc(pool), tmp_ct(pool);
+            copy_ct_acc = chunk_response[i * num_buckets_merged + j];
+            tmp_ct = copy_ct_acc;
             // copy logic: copy_ct_acc will hold coppied result
             for (size_t k = 1; k < row_size_ / current_fill; k *= 2)
             {
-                evaluator_->rotate_rows_inplace(tmp_ct, -1 * k * current_fill, client_keys_[client_id].first);
+                evaluator_->rotate_rows_inplace(tmp_ct, -1 * k * current_fill, galois_keys, pool);
                 evaluator_->add_inplace(copy_ct_acc, tmp_ct);
                 tmp_ct = copy_ct_acc;
             }
 
             // selection logic: select consecutive gap_  entries from each bucket
-            std::vector<uint64_t> selection_vector(polynomial_degree_, 0ULL);
-            std::fill_n(selection_vector.begin() + (j * current_fill), current_fill, 1ULL);
-            std::fill_n(selection_vector.begin() + row_size_ + (j * current_fill), current_fill, 1ULL);
-
-            Plaintext selection_pt;
-            batch_encoder_->encode(selection_vector, selection_pt);
-            evaluator_->multiply_plain_inplace(copy_ct_acc, selection_pt);
+            multiply_selection_mask(copy_ct_acc, chunk_selection_masks_[j], pool);
             if (j == 0)
             {
                 ct_acc = copy_ct_acc;
@@ -437,24 +517,36 @@ PIRResponseList Server::merge_responses_chunks_buckets(vector<PIRResponseList> &
                 evaluator_->add_inplace(ct_acc, copy_ct_acc);
             }
         }
-        chunk_bucket_responses.push_back(ct_acc);
+        evaluator_->transform_from_ntt_inplace(ct_acc);
+        chunk_bucket_responses.push_back(std::move(ct_acc));
     }
 
     
-    modulus_switch(chunk_bucket_responses);
+    modulus_switch(chunk_bucket_responses, pool);
     return chunk_bucket_responses;
 }
 
-void Server::modulus_switch(PIRResponseList& list){
+void Server::modulus_switch(PIRResponseList& list, seal::MemoryPoolHandle pool) const {
+    // switch down to the lowest level the response codec considers safe
     for( int i = 0; i < list.size(); i++){
-        evaluator_->mod_switch_to_next_inplace(list[i]);
-        //evaluator_->mod_switch_to_next_inplace(list[i]);
-    
+        response_codec_.mod_switch(*evaluator_, list[i], pool);
+    }
+}
+
+CompressedResponseList Server::compress_responses(const PIRResponseList &responses) const
+{
+    CompressedResponseList compressed;
+    compressed.reserve(responses.size());
+    for (const auto &ct : responses)
+    {
+        compressed.push_back(response_codec_.compress(ct));
     }
+    return compressed;
 }
 
-PIRResponseList Server::merge_responses_buckets_chunks(vector<PIRResponseList> &responses, uint32_t client_id)
+PIRResponseList Server::merge_responses_buckets_chunks(vector<PIRResponseList> &responses, uint32_t client_id, seal::MemoryPoolHandle pool) const
 {
+    const auto &galois_keys = get_keys(client_id).first;
 
     auto current_fill = responses.size() * gap_;
     if (current_fill > row_size_)
@@ -466,31 +558,26 @@ PIRResponseList Server::merge_responses_buckets_chunks(vector<PIRResponseList> &
     // go over the chunks
     for (int j = 0; j < responses[0].size(); j++)
     {
-        Ciphertext bucket_ct_acc;
+        Ciphertext bucket_ct_acc(pool);
 
         // go over the buckets
         for (int i = 0; i < responses.size(); i++)
         {
-            Ciphertext ct_acc = responses[i][j];
-            Ciphertext ct = ct_acc;
+            Ciphertext ct_acc(pool), ct(pool);
+            ct_acc = responses[i][j];
+            ct = ct_acc;
 
             // copy logic: ct_acc will hold coppied result
             for (size_t k = 1; k < row_size_ / gap_; k *= 2)
             {
-                evaluator_->rotate_rows_inplace(ct, -1 * k * gap_, client_keys_[client_id].first);
+                evaluator_->rotate_rows_inplace(ct, -1 * k * gap_, galois_keys, pool);
                 evaluator_->add_inplace(ct_acc, ct);
                 ct = ct_acc;
             }
 
             // selection logic: select consecutive gap_  entries from each bucket
-            std::vector<uint64_t> selection_vector(polynomial_degree_, 0ULL);
-            std::fill_n(selection_vector.begin() + (i * gap_), gap_, 1ULL);
-            std::fill_n(selection_vector.begin() + row_size_ + (i * gap_), gap_, 1ULL);
-
-            cout << endl;
-            Plaintext pt;
-            batch_encoder_->encode(selection_vector, pt);
-            evaluator_->multiply_plain(ct_acc, pt, ct);
+            ct = ct_acc;
+            multiply_selection_mask(ct, bucket_selection_masks_[i], pool);
 
             // if first bucket nothing to accumlate
             if (i == 0)
@@ -502,7 +589,8 @@ PIRResponseList Server::merge_responses_buckets_chunks(vector<PIRResponseList> &
                 evaluator_->add_inplace(bucket_ct_acc, ct);
             }
         }
-        bucket_response.push_back(bucket_ct_acc);
+        evaluator_->transform_from_ntt_inplace(bucket_ct_acc);
+        bucket_response.push_back(std::move(bucket_ct_acc));
     }
 
     // check if ciphertexts dont have space then return
@@ -517,13 +605,14 @@ PIRResponseList Server::merge_responses_buckets_chunks(vector<PIRResponseList> &
 
     for (int i = 0; i < ciphertext_needed; i++)
     {
-        Ciphertext chunk_ct_acc = bucket_response[i * capacity];
+        Ciphertext chunk_ct_acc(pool);
+        chunk_ct_acc = bucket_response[i * capacity];
         for (int j = 1; j < capacity; j++)
         {
-            evaluator_->rotate_rows_inplace(bucket_response[j + (i * capacity)], -1 * i * gap_, client_keys_[client_id].first);
+            evaluator_->rotate_rows_inplace(bucket_response[j + (i * capacity)], -1 * i * gap_, galois_keys, pool);
             evaluator_->add_inplace(chunk_ct_acc, bucket_response[j]);
         }
-        bucket_chunk_response.push_back(chunk_ct_acc);
+        bucket_chunk_response.push_back(std::move(chunk_ct_acc));
     }
 
     return bucket_chunk_response;
@@ -651,7 +740,74 @@ void Server::ntt_preprocess_db()
     std::cout << "BatchPIRServer: Database is NTT processed!" << std::endl;
 }
 
-std::vector<uint64_t> Server::convert_to_list_of_coeff(std::vector<unsigned char> input_list)
+size_t Server::update_entries(const vector<size_t> &db_indices, const vector<size_t> &entry_indices, const RawDB &entries)
+{
+    if (db_indices.size() != entry_indices.size() || db_indices.size() != entries.size())
+    {
+        throw std::invalid_argument("Error: update_entries was given inputs of different sizes");
+    }
+    if (encoded_db_.size() != db_.size())
+    {
+        throw std::logic_error("Error: Database must be encoded before it can be updated");
+    }
+
+    const auto total_db_plaintexts = pir_params_.get_db_rows();
+    const auto total_rawdb_entries = pir_params_.get_rounded_num_entries();
+    const auto num_columns_per_entry = pir_params_.get_num_slots_per_entry();
+    const size_t plaintexts_per_chunk = total_rawdb_entries / pir_dimensions_[0];
+
+    std::set<size_t> touched;
+    for (size_t k = 0; k < entries.size(); k++)
+    {
+        const auto r = db_indices[k];
+        const auto i = entry_indices[k];
+        if (r >= rawdb_list_.size() || i >= total_rawdb_entries)
+        {
+            throw std::out_of_range("Error: update_entries index out of range");
+        }
+
+        auto old_coeffs = convert_to_list_of_coeff(rawdb_list_[r][i]);
+        auto new_coeffs = convert_to_list_of_coeff(entries[k]);
+        rawdb_list_[r][i] = entries[k];
+
+        // Follow the layout of convert_to_pir_db, merge_to_db and rotate_db_cols:
+        // databases at or above gap_ live in the second row, each database is
+        // rotated by its index and each plaintext by its column in the second dimension.
+        const size_t half = r >= gap_ ? row_size_ : 0;
+        const size_t rotation = r >= gap_ ? r - gap_ : r;
+        size_t plaintext_idx = i / pir_dimensions_[0];
+
+        for (int j = 0; j < num_columns_per_entry; j++)
+        {
+            if (plaintext_idx >= total_db_plaintexts)
+            {
+                throw std::out_of_range("Error: update_entries plaintext index out of range");
+            }
+
+            const size_t col_rotation = (plaintext_idx % pir_dimensions_[1]) * gap_;
+            const size_t slot = half + ((i * gap_) % row_size_ + rotation + col_rotation) % row_size_;
+
+            // the merged slot is the sum of all databases, so swap only our share
+            db_[plaintext_idx][slot] = db_[plaintext_idx][slot] - old_coeffs[j] + new_coeffs[j];
+            touched.insert(plaintext_idx);
+            plaintext_idx += plaintexts_per_chunk;
+        }
+    }
+
+    auto pid = context_->first_parms_id();
+    for (auto idx : touched)
+    {
+        batch_encoder_->encode(db_[idx], encoded_db_[idx]);
+        if (is_db_preprocessed_)
+        {
+            evaluator_->transform_to_ntt_inplace(encoded_db_[idx], pid);
+        }
+    }
+
+    return touched.size();
+}
+
+std::vector<uint64_t> Server::convert_to_list_of_coeff(const std::vector<unsigned char> &input_list)
 {
     auto size_of_input = input_list.size();
     const int size_of_coeff = plaint_bit_count_ - 1;
@@ -698,50 +854,50 @@ bool Server::print_raw_database_status()
     }
 }
 
-vector<seal::Ciphertext> Server::rotate_copy_query(uint32_t client_id)
+vector<seal::Ciphertext> Server::rotate_copy_query(const RequestContext &request) const
 {
     vector<seal::Ciphertext> rotated_query;
 
     for (int i = 0; i < pir_dimensions_[0]; i++)
     {
-        Ciphertext ct;
-        evaluator_->rotate_rows(query_[0], -1 * i * gap_, client_keys_[client_id].first, ct);
+        Ciphertext ct(request.pool);
+        evaluator_->rotate_rows((*request.query)[0], -1 * i * gap_, *request.galois_keys, ct, request.pool);
         evaluator_->transform_to_ntt_inplace(ct);
-        rotated_query.push_back(ct);
+        rotated_query.push_back(std::move(ct));
     }
 
     return rotated_query;
 }
 
-vector<Ciphertext> Server::process_first_dimension(uint32_t client_id)
+vector<Ciphertext> Server::process_first_dimension(RequestContext &request) const
 {
 
-    auto rotated_query = rotate_copy_query(client_id);
+    auto rotated_query = rotate_copy_query(request);
     vector<Ciphertext> first_intermediate_data;
 
-    Ciphertext ct_acc;
-    Ciphertext ct;
+    Ciphertext ct(request.pool);
     for (int idx = 0; idx < encoded_db_.size(); idx += pir_dimensions_[1])
     {
-        evaluator_->multiply_plain(rotated_query[0], encoded_db_[idx], ct_acc);
+        Ciphertext ct_acc(request.pool);
+        evaluator_->multiply_plain(rotated_query[0], encoded_db_[idx], ct_acc, request.pool);
 
         for (int i = 1; i < pir_dimensions_[1]; i++)
         {
 
-            evaluator_->multiply_plain(rotated_query[i], encoded_db_[idx + i], ct);
+            evaluator_->multiply_plain(rotated_query[i], encoded_db_[idx + i], ct, request.pool);
             evaluator_->add_inplace(ct_acc, ct);
         }
 
         evaluator_->transform_from_ntt_inplace(ct_acc);
-        first_intermediate_data.push_back(ct_acc);
+        first_intermediate_data.push_back(std::move(ct_acc));
     }
 
     return first_intermediate_data;
 }
 
-vector<Ciphertext> Server::process_first_dimension_delayed_mod(uint32_t client_id)
+vector<Ciphertext> Server::process_first_dimension_delayed_mod(RequestContext &request) const
 {
-    auto rotated_query = rotate_copy_query(client_id);
+    auto rotated_query = rotate_copy_query(request);
     vector<Ciphertext> first_intermediate_data;
 
     auto context_data_ptr = context_->get_context_data(rotated_query[0].parms_id());
@@ -751,14 +907,16 @@ vector<Ciphertext> Server::process_first_dimension_delayed_mod(uint32_t client_i
     size_t coeff_count = parms.poly_modulus_degree();
     size_t coeff_mod_count = coeff_modulus.size();
     size_t encrypted_ntt_size = rotated_query[0].size();
-    std::vector<std::vector<uint128_t>> buffer(encrypted_ntt_size, std::vector<uint128_t>(coeff_count * coeff_mod_count, 0));
-
-    Ciphertext ct_acc;
+    auto &buffer = request.product_buffer;
+    buffer.resize(encrypted_ntt_size);
 
     for (int col_id = 0; col_id < encoded_db_.size(); col_id += pir_dimensions_[1])
     {
 
-        std::vector<std::vector<uint128_t>> buffer(encrypted_ntt_size, std::vector<uint128_t>(coeff_count * coeff_mod_count, 1));
+        for (auto &poly_buffer : buffer)
+        {
+            poly_buffer.assign(coeff_count * coeff_mod_count, 1);
+        }
         for (int i = 0; i < pir_dimensions_[1]; i++)
         {
             for (size_t poly_id = 0; poly_id < encrypted_ntt_size; poly_id++)
@@ -767,11 +925,12 @@ vector<Ciphertext> Server::process_first_dimension_delayed_mod(uint32_t client_i
             }
         }
 
+        Ciphertext ct_acc(request.pool);
         ct_acc = rotated_query[0];
         for (size_t poly_id = 0; poly_id < encrypted_ntt_size; poly_id++)
         {
             auto ct_ptr = ct_acc.data(poly_id);
-            auto pt_ptr = buffer[poly_id];
+            auto &pt_ptr = buffer[poly_id];
             for (int mod_id = 0; mod_id < coeff_mod_count; mod_id++)
             {
                 auto mod_idx = (mod_id * coeff_count);
@@ -786,15 +945,98 @@ vector<Ciphertext> Server::process_first_dimension_delayed_mod(uint32_t client_i
 
         evaluator_->transform_from_ntt_inplace(ct_acc);
         //evaluator_->mod_switch_to_next_inplace(ct_acc);
-        first_intermediate_data.push_back(ct_acc);
+        first_intermediate_data.push_back(std::move(ct_acc));
     }
     return first_intermediate_data;
 }
 
-vector<Ciphertext> Server::old_process_first_dimension_delayed_mod(uint32_t client_id)
+vector<vector<Ciphertext>> Server::process_first_dimension_batched(vector<RequestContext> &requests) const
 {
+    const size_t num_requests = requests.size();
+    vector<vector<Ciphertext>> rotated_queries(num_requests);
+    for (size_t r = 0; r < num_requests; r++)
+    {
+        rotated_queries[r] = rotate_copy_query(requests[r]);
+    }
+
+    auto context_data_ptr = context_->get_context_data(rotated_queries[0][0].parms_id());
+    auto &context_data = *context_data_ptr;
+    auto &parms = context_data.parms();
+    auto &coeff_modulus = parms.coeff_modulus();
+    size_t coeff_count = parms.poly_modulus_degree();
+    size_t coeff_mod_count = coeff_modulus.size();
+    size_t encrypted_ntt_size = rotated_queries[0][0].size();
+    const size_t poly_size = coeff_count * coeff_mod_count;
+
+    // A tile of a plaintext is multiplied with the same tile of every query while it is
+    // in L1, and the accumulators of all requests for one tile stay in L2.
+    size_t tile = FirstDimensionTileCoeffs;
+    if (poly_size % tile != 0)
+    {
+        tile = coeff_count;
+    }
+
+    for (auto &request : requests)
+    {
+        request.product_buffer.resize(encrypted_ntt_size);
+    }
 
-    auto rotated_query = rotate_copy_query(client_id);
+    vector<vector<Ciphertext>> first_intermediate_data(num_requests);
+    for (int col_id = 0; col_id < encoded_db_.size(); col_id += pir_dimensions_[1])
+    {
+        for (auto &request : requests)
+        {
+            for (auto &poly_buffer : request.product_buffer)
+            {
+                poly_buffer.assign(poly_size, 1);
+            }
+        }
+
+        for (size_t begin = 0; begin < poly_size; begin += tile)
+        {
+            for (int i = 0; i < pir_dimensions_[1]; i++)
+            {
+                const uint64_t *pt_ptr = encoded_db_[col_id + i].data() + begin;
+                for (size_t r = 0; r < num_requests; r++)
+                {
+                    for (size_t poly_id = 0; poly_id < encrypted_ntt_size; poly_id++)
+                    {
+                        utils::multiply_poly_acum(rotated_queries[r][i].data(poly_id) + begin, pt_ptr, tile, requests[r].product_buffer[poly_id].data() + begin);
+                    }
+                }
+            }
+        }
+
+        for (size_t r = 0; r < num_requests; r++)
+        {
+            Ciphertext ct_acc(requests[r].pool);
+            ct_acc = rotated_queries[r][0];
+            for (size_t poly_id = 0; poly_id < encrypted_ntt_size; poly_id++)
+            {
+                auto ct_ptr = ct_acc.data(poly_id);
+                auto &pt_ptr = requests[r].product_buffer[poly_id];
+                for (int mod_id = 0; mod_id < coeff_mod_count; mod_id++)
+                {
+                    auto mod_idx = (mod_id * coeff_count);
+
+                    for (int coeff_id = 0; coeff_id < coeff_count; coeff_id++)
+                    {
+                        ct_ptr[coeff_id + mod_idx] = static_cast<uint64_t>(pt_ptr[coeff_id + mod_idx] % static_cast<__uint128_t>(coeff_modulus[mod_id].value()));
+                    }
+                }
+            }
+
+            evaluator_->transform_from_ntt_inplace(ct_acc);
+            first_intermediate_data[r].push_back(std::move(ct_acc));
+        }
+    }
+    return first_intermediate_data;
+}
+
+vector<Ciphertext> Server::old_process_first_dimension_delayed_mod(RequestContext &request) const
+{
+
+    auto rotated_query = rotate_copy_query(request);
     vector<Ciphertext> first_intermediate_data;
 
     auto context_data_ptr = context_->get_context_data(rotated_query[0].parms_id());
@@ -808,7 +1050,8 @@ vector<Ciphertext> Server::old_process_first_dimension_delayed_mod(uint32_t clie
 
     for (int col_id = 0; col_id < encoded_db_.size(); col_id += pir_dimensions_[1])
     {
-        Ciphertext ct_acc = rotated_query[0];
+        Ciphertext ct_acc(request.pool);
+        ct_acc = rotated_query[0];
         for (size_t poly_id = 0; poly_id < encrypted_ntt_size; poly_id++)
         {
             // looping through each coefficient
@@ -829,39 +1072,40 @@ vector<Ciphertext> Server::old_process_first_dimension_delayed_mod(uint32_t clie
             }
         }
         // evaluator_->transform_from_ntt_inplace(ct_acc);
-        first_intermediate_data.push_back(ct_acc);
+        first_intermediate_data.push_back(std::move(ct_acc));
     }
 
     return first_intermediate_data;
 }
 
-vector<Ciphertext> Server::process_second_dimension(uint32_t client_id, vector<Ciphertext> first_intermediate_data)
+vector<Ciphertext> Server::process_second_dimension(RequestContext &request, const vector<Ciphertext> &first_intermediate_data) const
 {
 
     vector<Ciphertext> second_intermediate_data;
 
-    Ciphertext ct_acc;
-    Ciphertext ct1, ct2;
+    auto &pool = request.pool;
+    Ciphertext ct1(pool);
     
     for (int idx = 0; idx < first_intermediate_data.size(); idx += pir_dimensions_[2])
     {
 
-        evaluator_->multiply(query_[1], first_intermediate_data[idx], ct_acc);
-        evaluator_->mod_switch_to_next_inplace(ct_acc);
-        evaluator_->relinearize_inplace(ct_acc, client_keys_[client_id].second);
+        Ciphertext ct_acc(pool);
+        evaluator_->multiply((*request.query)[1], first_intermediate_data[idx], ct_acc, pool);
+        evaluator_->mod_switch_to_next_inplace(ct_acc, pool);
+        evaluator_->relinearize_inplace(ct_acc, *request.relin_keys, pool);
 
         for (int i = 1; i < pir_dimensions_[2]; i += 1)
         {
 
-            evaluator_->multiply(query_[1], first_intermediate_data[idx + i], ct1);
-            evaluator_->mod_switch_to_next_inplace(ct1);
-            evaluator_->relinearize_inplace(ct1, client_keys_[client_id].second);
-            evaluator_->rotate_rows_inplace(ct1, -1 * i * gap_, client_keys_[client_id].first);
+            evaluator_->multiply((*request.query)[1], first_intermediate_data[idx + i], ct1, pool);
+            evaluator_->mod_switch_to_next_inplace(ct1, pool);
+            evaluator_->relinearize_inplace(ct1, *request.relin_keys, pool);
+            evaluator_->rotate_rows_inplace(ct1, -1 * i * gap_, *request.galois_keys, pool);
             evaluator_->add_inplace(ct_acc, ct1);
         }
 
         
-        second_intermediate_data.push_back(ct_acc);
+        second_intermediate_data.push_back(std::move(ct_acc));
     }
 
     if (second_intermediate_data.size() != pir_params_.get_num_slots_per_entry())
@@ -873,20 +1117,74 @@ vector<Ciphertext> Server::process_second_dimension(uint32_t client_id, vector<C
     return second_intermediate_data;
 }
 
-PIRResponseList Server::process_last_dimension(uint32_t client_id, vector<Ciphertext> second_intermediate_data, bool is_2d_pir_)
+vector<Ciphertext> Server::process_second_dimension_lazy_relin(RequestContext &request, const vector<Ciphertext> &first_intermediate_data) const
+{
+    // Rotations only work on size-2 ciphertexts, so instead of rotating each relinearized
+    // product we use rot(q * d) = rot(q) * rot(d): the query is rotated once per term index
+    // and shared by all outputs, the size-2 intermediate data is rotated before the product,
+    // and the size-3 products are summed and relinearized once per output.
+    auto &pool = request.pool;
+    // copies of a Ciphertext allocate from the global pool, so build them in place,
+    // rotated_query[0] is the query itself and is not copied
+    vector<Ciphertext> rotated_query;
+    rotated_query.reserve(pir_dimensions_[2]);
+    for (int i = 0; i < pir_dimensions_[2]; i++)
+    {
+        rotated_query.emplace_back(pool);
+    }
+    for (int i = 1; i < pir_dimensions_[2]; i++)
+    {
+        evaluator_->rotate_rows((*request.query)[1], -1 * i * gap_, *request.galois_keys, rotated_query[i], pool);
+    }
+
+    vector<Ciphertext> second_intermediate_data;
+
+    Ciphertext ct1(pool), ct2(pool);
+
+    for (int idx = 0; idx < first_intermediate_data.size(); idx += pir_dimensions_[2])
+    {
+        Ciphertext ct_acc(pool);
+        evaluator_->multiply((*request.query)[1], first_intermediate_data[idx], ct_acc, pool);
+
+        for (int i = 1; i < pir_dimensions_[2]; i += 1)
+        {
+            evaluator_->rotate_rows(first_intermediate_data[idx + i], -1 * i * gap_, *request.galois_keys, ct2, pool);
+            evaluator_->multiply(rotated_query[i], ct2, ct1, pool);
+            evaluator_->add_inplace(ct_acc, ct1);
+        }
+
+        evaluator_->mod_switch_to_next_inplace(ct_acc, pool);
+        evaluator_->relinearize_inplace(ct_acc, *request.relin_keys, pool);
+        second_intermediate_data.push_back(std::move(ct_acc));
+    }
+
+    if (second_intermediate_data.size() != pir_params_.get_num_slots_per_entry())
+    {
+        // Throw an exception
+        throw runtime_error("Error: Size of second_intermediate_data is not equal to pir_params_.get_num_slots_per_entry()");
+    }
+
+    return second_intermediate_data;
+}
+
+PIRResponseList Server::process_last_dimension(RequestContext &request, const vector<Ciphertext> &second_intermediate_data, bool is_2d_pir_) const
 {
     PIRResponseList ct_acc;
+    // the query is not modified, switch a copy down to the level of the second dimension
+    const Ciphertext *last_query = &request.query->back();
+    Ciphertext switched_query(request.pool);
     if(!is_2d_pir_){
-        evaluator_->mod_switch_to_next_inplace(query_.back());
+        evaluator_->mod_switch_to_next(request.query->back(), switched_query, request.pool);
+        last_query = &switched_query;
     }
     for (int idx = 0; idx < second_intermediate_data.size(); idx++)
     {
-        Ciphertext ct;
-        evaluator_->multiply(query_.back(), second_intermediate_data[idx], ct);
+        Ciphertext ct(request.pool);
+        evaluator_->multiply(*last_query, second_intermediate_data[idx], ct, request.pool);
 
-        evaluator_->relinearize_inplace(ct, client_keys_[client_id].second);
+        evaluator_->relinearize_inplace(ct, *request.relin_keys, request.pool);
 
-        ct_acc.push_back(ct);
+        ct_acc.push_back(std::move(ct));
     }
     return ct_acc;
 }
@@ -899,45 +1197,108 @@ PIRResponseList Server::process_last_dimension(uint32_t client_id, vector<Cipher
 //     return response;
 // };
 
-PIRResponseList Server::generate_response(uint32_t client_id, PIRQuery query)
+void Server::set_lazy_relinearization(bool lazy)
+{
+    lazy_relin_ = lazy;
+}
+
+std::array<double, 3> Server::get_stage_times() const
+{
+    return stage_times_;
+}
+
+PIRResponseList Server::generate_response(uint32_t client_id, const PIRQuery &query)
+{
+    RequestContext request = make_request_context(client_id, query);
+    PIRResponseList response = generate_response(request);
+    stage_times_ = request.stage_times;
+    return response;
+}
+
+RequestContext Server::make_request_context(uint32_t client_id, const PIRQuery &query, seal::MemoryPoolHandle pool) const
+{
+    const auto &keys = get_keys(client_id);
+
+    RequestContext request;
+    request.client_id = client_id;
+    request.pool = pool;
+    request.query = &query;
+    request.galois_keys = &keys.first;
+    request.relin_keys = &keys.second;
+    return request;
+}
+
+PIRResponseList Server::generate_response(RequestContext &request) const
 {
 
     if (!is_db_preprocessed_)
         throw runtime_error("Error: Database not preprocessed");
 
-    query_ = query;
+    if (request.query->size() != pir_dimensions_.size())
+        throw std::invalid_argument("Error: Query does not match the PIR dimensions");
 
-    // Time process_first_dimension function
     // auto start = chrono::high_resolution_clock::now();
-    // vector<Ciphertext> first_intermediate_data = process_first_dimension(client_id);
-    vector<Ciphertext> first_intermediate_data = process_first_dimension_delayed_mod(client_id);
-    // auto end = chrono::high_resolution_clock::now();
-    // auto duration = chrono::duration_cast<chrono::milliseconds>(end - start);
-    // cout << "Server: process_first_dimension time: " << duration.count() << " milliseconds" << endl;
-
-    // Time process_second_dimension function
-    // start = chrono::high_resolution_clock::now();
+    // vector<Ciphertext> first_intermediate_data = process_first_dimension(request);
+    auto start = chrono::high_resolution_clock::now();
+    vector<Ciphertext> first_intermediate_data = process_first_dimension_delayed_mod(request);
+    request.stage_times[0] = chrono::duration<double, std::milli>(chrono::high_resolution_clock::now() - start).count();
+
+    return process_remaining_dimensions(request, first_intermediate_data);
+}
+
+vector<PIRResponseList> Server::generate_responses(vector<RequestContext> &requests) const
+{
+    if (!is_db_preprocessed_)
+        throw runtime_error("Error: Database not preprocessed");
+
+    vector<PIRResponseList> responses;
+    if (requests.empty())
+        return responses;
+
+    for (auto &request : requests)
+    {
+        if (request.query->size() != pir_dimensions_.size())
+            throw std::invalid_argument("Error: Query does not match the PIR dimensions");
+    }
+
+    auto start = chrono::high_resolution_clock::now();
+    auto first_intermediate_data = process_first_dimension_batched(requests);
+    double first_dimension_time = chrono::duration<double, std::milli>(chrono::high_resolution_clock::now() - start).count();
+
+    for (size_t r = 0; r < requests.size(); r++)
+    {
+        requests[r].stage_times[0] = first_dimension_time;
+        responses.push_back(process_remaining_dimensions(requests[r], first_intermediate_data[r]));
+    }
+    return responses;
+}
+
+PIRResponseList Server::process_remaining_dimensions(RequestContext &request, const vector<Ciphertext> &first_intermediate_data) const
+{
+    auto elapsed_ms = [](chrono::high_resolution_clock::time_point start)
+    {
+        return chrono::duration<double, std::milli>(chrono::high_resolution_clock::now() - start).count();
+    };
+
+    auto start = chrono::high_resolution_clock::now();
     vector<Ciphertext> second_intermediate_data;
     if(pir_dimensions_.size() == 3){
-        second_intermediate_data = process_second_dimension(client_id, first_intermediate_data);
-    }else{
-        second_intermediate_data = first_intermediate_data;
+        if (lazy_relin_)
+            second_intermediate_data = process_second_dimension_lazy_relin(request, first_intermediate_data);
+        else
+            second_intermediate_data = process_second_dimension(request, first_intermediate_data);
     }
-    // end = chrono::high_resolution_clock::now();
-    // duration = chrono::duration_cast<chrono::milliseconds>(end - start);
-    // cout << "Server: process_second_dimension time: " << duration.count() << " milliseconds" << endl;
+    request.stage_times[1] = elapsed_ms(start);
 
-    // Time process_third_dimension function
-    // start = chrono::high_resolution_clock::now();
-    PIRResponseList response = process_last_dimension(client_id, second_intermediate_data, pir_dimensions_.size() == 2);
-    // end = chrono::high_resolution_clock::now();
-    // duration = chrono::duration_cast<chrono::milliseconds>(end - start);
-    // cout << "Server: process_third_dimension time: " << duration.count() << " milliseconds" << endl;
+    // the last products are relinearized right away, the responses are rotated when merged
+    start = chrono::high_resolution_clock::now();
+    PIRResponseList response = process_last_dimension(request, pir_dimensions_.size() == 3 ? second_intermediate_data : first_intermediate_data, pir_dimensions_.size() == 2);
+    request.stage_times[2] = elapsed_ms(start);
 
     return response;
 }
 
-bool Server::check_decoded_entry(std::vector<unsigned char> entry, int index)
+bool Server::check_decoded_entry(const std::vector<unsigned char> &entry, int index)
 {
     if (entry.size() != rawdb_list_[1][index].size())
     {
@@ -970,7 +1331,7 @@ bool Server::check_decoded_entry(std::vector<unsigned char> entry, int index)
     return result;
 }
 
-bool Server::check_decoded_entries(std::vector<std::vector<unsigned char>> entries, vector<uint64_t> indices)
+bool Server::check_decoded_entries(const std::vector<std::vector<unsigned char>> &entries, const vector<uint64_t> &indices)
 {
     for (int i = 0; i < num_databases_; i++)
     {
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "coproto/coproto.h"
+#include "cryptoTools/Common/Defines.h"
+
+// A link with a bandwidth cap, one way latency and jitter. Zero bandwidth means unlimited.
+// 带宽上限、单向延迟和抖动描述的链路。带宽为 0 表示不限。
+struct NetworkModel
+{
+	double mMbps = 0;
+	double mRttMs = 0;
+	double mJitterMs = 0;
+
+	std::string name() const
+	{
+		if (mMbps == 0 && mRttMs == 0)
+			return "local";
+		return std::to_string(oc::u64(mMbps)) + "Mbps/" + std::to_string(oc::u64(mRttMs)) + "ms";
+	}
+};
+
+// In-process socket pair that delivers the bytes of every send after the
+// transmission time at the model's bandwidth plus half the round trip time
+// and a random jitter. Each direction is one link: sends queue behind the
+// previous ones and are delivered in order.
+// The operations block the calling thread, so each party has to run on its
+// own thread, see perfOkvrNet. Nothing touches the real network.
+// 进程内的 socket 对。每次发送的字节在按带宽计算的传输时间、半个往返时延和随机抖动之后才能被接收。
+// 每个方向是一条链路：发送按顺序排队并按顺序交付。
+// 操作会阻塞调用线程，因此每一方需在自己的线程中运行，见 perfOkvrNet。不使用真实网络。
+struct EmulatedSocket : public coproto::Socket
+{
+	using Clock = std::chrono::steady_clock;
+
+	// one direction of the link / 链路的一个方向
+	struct Link
+	{
+		struct Packet
+		{
+			std::vector<oc::u8> mData;
+			oc::u64 mOffset = 0;
+			Clock::time_point mArrival;
+		};
+
+		std::mutex mMtx;
+		std::condition_variable mCv;
+		std::deque<Packet> mPackets;
+		Clock::time_point mFree = Clock::time_point::min();
+		Clock::time_point mLastArrival = Clock::time_point::min();
+		std::mt19937_64 mPrng;
+		bool mClosed = false;
+	};
+
+	struct Sock
+	{
+		NetworkModel mModel;
+		std::shared_ptr<Link> mOut, mIn;
+
+		// the awaiters complete in await_ready, blocking until the bytes are sent/arrived
+		// 在 await_ready 中完成，阻塞直到字节发送/到达
+		struct Awaiter
+		{
+			std::pair<coproto::error_code, oc::u64> mResult;
+			bool await_ready() { return true; }
+			void await_suspend(std::coroutine_handle<>) {}
+			std::pair<coproto::error_code, oc::u64> await_resume() { return mResult; }
+		};
+
+		Awaiter send(coproto::span<oc::u8> data, macoro::stop_token token = {})
+		{
+			auto &link = *mOut;
+			std::lock_guard<std::mutex> lock(link.mMtx);
+			if (link.mClosed)
+				return {{coproto::code::closed, 0}};
+
+			// 排在前一次发送之后，按带宽计算传输时间 / queue behind the previous send, transmit at the bandwidth
+			auto now = Clock::now();
+			auto start = std::max(now, link.mFree);
+			auto transmit = mModel.mMbps > 0 ? data.size() * 8 / mModel.mMbps : 0.0; // us
+			link.mFree = start + std::chrono::nanoseconds(oc::u64(transmit * 1000));
+
+			auto delayMs = mModel.mRttMs / 2;
+			if (mModel.mJitterMs > 0)
+				delayMs += std::uniform_real_distribution<double>(0, mModel.mJitterMs)(link.mPrng);
+			auto arrival = link.mFree + std::chrono::nanoseconds(oc::u64(delayMs * 1000000));
+			// 抖动不能打乱顺序 / jitter must not reorder the stream
+			arrival = std::max(arrival, link.mLastArrival);
+			link.mLastArrival = arrival;
+
+			link.mPackets.push_back({std::vector<oc::u8>(data.begin(), data.end()), 0, arrival});
+			link.mCv.notify_all();
+			return {{coproto::error_code{}, data.size()}};
+		}
+
+		Awaiter recv(coproto::span<oc::u8> data, macoro::stop_token token = {})
+		{
+			auto &link = *mIn;
+			std::unique_lock<std::mutex> lock(link.mMtx);
+			oc::u64 done = 0;
+			while (done < data.size())
+			{
+				if (link.mPackets.empty())
+				{
+					if (link.mClosed)
+						return {{coproto::code::remoteClosed, done}};
+					link.mCv.wait(lock);
+					continue;
+				}
+
+				auto &packet = link.mPackets.front();
+				if (Clock::now() < packet.mArrival)
+				{
+					link.mCv.wait_until(lock, packet.mArrival);
+					continue;
+				}
+
+				auto n = std::min<oc::u64>(data.size() - done, packet.mData.size() - packet.mOffset);
+				std::memcpy(data.data() + done, packet.mData.data() + packet.mOffset, n);
+				done += n;
+				packet.mOffset += n;
+				if (packet.mOffset == packet.mData.size())
+					link.mPackets.pop_front();
+			}
+			return {{coproto::error_code{}, done}};
+		}
+
+		void close()
+		{
+			for (auto link : {mOut, mIn})
+			{
+				std::lock_guard<std::mutex> lock(link->mMtx);
+				link->mClosed = true;
+				link->mCv.notify_all();
+			}
+		}
+	};
+
+	EmulatedSocket() = default;
+	EmulatedSocket(EmulatedSocket &&) = default;
+	EmulatedSocket &operator=(EmulatedSocket &&) = default;
+
+	static std::array<EmulatedSocket, 2> makePair(const NetworkModel &model, oc::u64 seed = 0)
+	{
+		auto ab = std::make_shared<Link>();
+		auto ba = std::make_shared<Link>();
+		ab->mPrng.seed(seed);
+		ba->mPrng.seed(seed + 1);
+		return {{EmulatedSocket(model, ab, ba), EmulatedSocket(model, ba, ab)}};
+	}
+
+private:
+	EmulatedSocket(const NetworkModel &model, std::shared_ptr<Link> out, std::shared_ptr<Link> in)
+		: coproto::Socket(coproto::make_socket_tag{}, std::unique_ptr<Sock>(new Sock{model, std::move(out), std::move(in)}))
+	{
+	}
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "cryptoTools/Common/CLP.h"
+#include "cryptoTools/Common/Defines.h"
+
+// Small harness used by the micro benchmarks. Each benchmark is run
+// mWarmup times untimed and then mReps times timed. The median and
+// p99 of the timed repetitions are reported as ns/item and GB/s.
+// 微基准测试的辅助工具。每个基准先执行 mWarmup 次预热（不计时），再计时执行 mReps 次，
+// 输出中位数与 p99，以 ns/item 和 GB/s 表示。
+struct BenchOptions
+{
+	enum Format
+	{
+		Text,
+		Csv,
+		Json
+	};
+
+	oc::u64 mWarmup = 2;
+	oc::u64 mReps = 10;
+
+	// the core the benchmark thread is pinned to, -1 for no pinning.
+	// 基准线程绑定的核心，-1 表示不绑定。
+	oc::i64 mPin = -1;
+
+	Format mFormat = Text;
+
+	// if non-empty, only benchmarks whose name starts with one of these are run.
+	// 若非空，则只运行名称以其中之一为前缀的基准。
+	std::vector<std::string> mFilter;
+
+	static BenchOptions fromCmd(const oc::CLP &cmd)
+	{
+		BenchOptions opts;
+		opts.mWarmup = cmd.getOr("warmup", opts.mWarmup);
+		opts.mReps = std::max<oc::u64>(1, cmd.getOr("reps", opts.mReps));
+		opts.mPin = cmd.getOr("pin", opts.mPin);
+		if (cmd.isSet("json"))
+			opts.mFormat = Json;
+		else if (cmd.isSet("csv"))
+			opts.mFormat = Csv;
+		opts.mFilter = cmd.getManyOr<std::string>("bench", {});
+		return opts;
+	}
+
+	bool enabled(const std::string &name) const
+	{
+		if (mFilter.empty())
+			return true;
+		for (auto &f : mFilter)
+			if (name.compare(0, f.size(), f) == 0)
+				return true;
+		return false;
+	}
+};
+
+// pin the calling thread to the given core. Returns false if
+// this is not supported on the current platform.
+// 将调用线程绑定到给定核心。若平台不支持则返回 false。
+inline bool pinThread(oc::u64 core)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	(void)core;
+	return false;
+#endif
+}
+
+struct BenchStats
+{
+	std::string mName;
+
+	// the number of items and bytes processed by one repetition.
+	// 一次重复处理的元素数量与字节数。
+	oc::u64 mItems = 0, mBytes = 0, mReps = 0;
+
+	double mMedianNs = 0, mP99Ns = 0, mMinNs = 0;
+
+	double nsPerItem() const { return mMedianNs / std::max<oc::u64>(1, mItems); }
+	double p99NsPerItem() const { return mP99Ns / std::max<oc::u64>(1, mItems); }
+
+	// bytes/ns == GB/s
+	double gbPerSec() const { return mMedianNs ? mBytes / mMedianNs : 0; }
+};
+
+class BenchReporter
+{
+public:
+	BenchOptions mOpts;
+	std::vector<BenchStats> mResults;
+	std::ostream &mOut;
+
+	BenchReporter(BenchOptions opts, std::ostream &out = std::cout)
+		: mOpts(std::move(opts)), mOut(out)
+	{
+		if (mOpts.mFormat == BenchOptions::Csv)
+			mOut << "name,items,bytes,reps,median_ns,p99_ns,min_ns,ns_per_item,p99_ns_per_item,gb_per_s" << std::endl;
+	}
+
+	// time fn() over the configured repetitions. prep() is called
+	// before every repetition (including warmup) and is not timed.
+	// 在配置的重复次数上对 fn() 计时。prep() 在每次重复（包括预热）前调用，不计时。
+	template <typename Fn, typename Prep>
+	void run(const std::string &name, oc::u64 items, oc::u64 bytes, Fn &&fn, Prep &&prep)
+	{
+		if (mOpts.enabled(name) == false)
+			return;
+
+		for (oc::u64 i = 0; i < mOpts.mWarmup; ++i)
+		{
+			prep();
+			fn();
+		}
+
+		std::vector<double> ns(mOpts.mReps);
+		for (oc::u64 i = 0; i < mOpts.mReps; ++i)
+		{
+			prep();
+			auto begin = std::chrono::steady_clock::now();
+			fn();
+			auto end = std::chrono::steady_clock::now();
+			ns[i] = std::chrono::duration<double, std::nano>(end - begin).count();
+		}
+		std::sort(ns.begin(), ns.end());
+
+		BenchStats s;
+		s.mName = name;
+		s.mItems = items;
+		s.mBytes = bytes;
+		s.mReps = ns.size();
+		s.mMedianNs = ns.size() % 2 ? ns[ns.size() / 2] : (ns[ns.size() / 2 - 1] + ns[ns.size() / 2]) / 2;
+		s.mP99Ns = ns[std::min<oc::u64>(ns.size() - 1, (oc::u64)std::ceil(0.99 * ns.size()) - 1)];
+		s.mMinNs = ns.front();
+		report(s);
+		mResults.push_back(s);
+	}
+
+	template <typename Fn>
+	void run(const std::string &name, oc::u64 items, oc::u64 bytes, Fn &&fn)
+	{
+		run(name, items, bytes, std::forward<Fn>(fn), [] {});
+	}
+
+	// emit anything that can only be written once all results are known.
+	// 输出只有在所有结果已知后才能写出的内容。
+	void finish()
+	{
+		if (mOpts.mFormat != BenchOptions::Json)
+			return;
+
+		mOut << "[\n";
+		for (oc::u64 i = 0; i < mResults.size(); ++i)
+		{
+			auto &s = mResults[i];
+			mOut << "  {\"name\": \"" << s.mName << "\""
+				 << ", \"items\": " << s.mItems
+				 << ", \"bytes\": " << s.mBytes
+				 << ", \"reps\": " << s.mReps
+				 << ", \"median_ns\": " << s.mMedianNs
+				 << ", \"p99_ns\": " << s.mP99Ns
+				 << ", \"min_ns\": " << s.mMinNs
+				 << ", \"ns_per_item\": " << s.nsPerItem()
+				 << ", \"p99_ns_per_item\": " << s.p99NsPerItem()
+				 << ", \"gb_per_s\": " << s.gbPerSec() << "}"
+				 << (i + 1 == mResults.size() ? "\n" : ",\n");
+		}
+		mOut << "]" << std::endl;
+	}
+
+private:
+	void report(const BenchStats &s)
+	{
+		if (mOpts.mFormat == BenchOptions::Csv)
+		{
+			mOut << s.mName << "," << s.mItems << "," << s.mBytes << "," << s.mReps << ","
+				 << s.mMedianNs << "," << s.mP99Ns << "," << s.mMinNs << ","
+				 << s.nsPerItem() << "," << s.p99NsPerItem() << "," << s.gbPerSec() << std::endl;
+		}
+		else if (mOpts.mFormat == BenchOptions::Text)
+		{
+			std::stringstream ss;
+			ss << std::left << std::setw(24) << s.mName << std::right << std::fixed << std::setprecision(2)
+			   << std::setw(12) << s.nsPerItem() << " ns/item (median)"
+			   << std::setw(12) << s.p99NsPerItem() << " ns/item (p99)"
+			   << std::setw(10) << s.gbPerSec() << " GB/s";
+			mOut << ss.str() << std::endl;
+		}
+	}
+};
@@ -33,9 +33,37 @@ int main(int argc, char **argv)
                   << "      -ssp <value>: statistical security parameter.\n"
                   << "      -binary: binary okvs dense columns.\n"
                   << "      -cols: The size of the okvs elemenst in multiples of 16 bytes. default = 1.\n"
+                  << "      -pf <value>: decode prefetch distance in 32-row batches, 0 disables. default = 2.\n"
+                  << "      -generic: use the generic decode kernel instead of the w=3, cols=1/2/4 specializations.\n"
                   << "   -baxos: The the bin okvs benchmark. Same parameters as -paxos plus.\n"
                   << "      -lbs <value>: the log2 bin size.\n"
-                  << "      -nt: number of threads.\n";
+                  << "      -nt: number of threads.\n"
+                  << "   -buildRow: The row hashing benchmark. Takes -n, -t, -b, -w, -ssp, -binary and -single.\n"
+                  << "   -mod: The libdivide mod benchmark. Takes -n.\n"
+                  << "   -micro: The okvs kernel micro benchmarks (hash, buildRow, mod32, decode32/8/1, decode32.generic, dense.gf128, backfill).\n"
+                  << "      Reports the gf128 and binary dense sizes next to their decode cost.\n"
+                  << "      -n <value>: The set size, rounded down to a multiple of 32. Can also set n using -nn.\n"
+                  << "      -b <value>: The bitcount of the index type, 16, 32 or 64. default = 32.\n"
+                  << "      -warmup <value>: untimed warmup repetitions. default = 2.\n"
+                  << "      -reps <value>: timed repetitions, the median and p99 are reported. default = 10.\n"
+                  << "      -pin <value>: pin the benchmark thread to the given core.\n"
+                  << "      -bench <names...>: only run benchmarks whose name starts with one of these.\n"
+                  << "      -csv, -json: machine readable output.\n"
+                  << "   -okvr: The OKVR benchmark. A full query round of Paxos over BatchPIR, the decoded values are checked.\n"
+                  << "      -n <value>: The set size. Can also set n using -nn.\n"
+                  << "      -k <values...>: encoding values packed per PIR entry, each value is benchmarked. default = 1.\n"
+                  << "      -vw <4|8|16>: the value width in bytes, a PIR entry is k * vw bytes. default = 16.\n"
+                  << "      -bin: use the binned okvs (Baxos), bins map to fixed groups of PIR buckets.\n"
+                  << "      -lbs <value>: the log2 bin size. -nt <value>: number of threads.\n"
+                  << "      -net: run the pipelined protocol over emulated links, report end-to-end time and traffic (Paxos only).\n"
+                  << "      -mbps <value> -rtt <ms> -jitter <ms>: the link, default = unlimited, 1000/1 and 10/80.\n"
+                  << "   -update: The incremental update benchmark. Times Paxos::updateValues and Baxos::resolveBins against a full solve.\n"
+                  << "      -n <value>: The set size. Can also set n using -nn.\n"
+                  << "      -frac <value>: the fraction of values changed/keys inserted. default = 0.01.\n"
+                  << "      Also takes -w, -ssp, -binary and -lbs.\n"
+                  << "   -readSet: The input file benchmark. Writes csv and binary sets and times readSet.\n"
+                  << "      -n <value>: The number of lines, e.g. 100000000. Can also set n using -nn.\n"
+                  << "      -nt <values...>: thread counts, 0 for one per core. default = 1 0. -dir <path>: where the files go, default = /tmp.\n";
 
         std::cout << oc::Color::Green << "Unit tests: \n"
                   << oc::Color::Default
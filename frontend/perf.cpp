@@ -1,4 +1,6 @@
 #include "perf.h"
+#include <thread>
+#include "benchUtil.h"
 #include "cryptoTools/Network/IOService.h"
 #include "cryptoTools/Common/Timer.h"
 
@@ -7,8 +9,10 @@
 #include "volePSI/SimpleIndex.h"
 #include "volePSI/PxUtil.h"
 #include "volePSI/Paxos.h"
+#include "volePSI/fileBased.h"
 
 #include "ourImp/Okvr.h"
+#include "EmulatedSocket.h"
 
 #include "libdivide.h"
 using namespace oc;
@@ -307,6 +311,8 @@ void perfPaxosImpl(oc::CLP &cmd)
 	auto ssp = cmd.getOr("ssp", 40);										// 获取 statistical security parameter
 	auto dt = cmd.isSet("binary") ? PaxosParam::Binary : PaxosParam::GF128; // 获取dense type类型 Binary or GF128
 	auto cols = cmd.getOr("cols", 0);										// 获取列数
+	auto pf = cmd.getOr("pf", Paxos<T>().mDecodePrefetch);				// 获取解码预取距离 (32行批次)
+	auto generic = cmd.isSet("generic");									// 是否禁用编译期特化的解码内核
 
 	PaxosParam pp(n, w, ssp, dt); // 初始化Paxos参数
 	// std::cout << "e=" << pp.size() / double(n) << std::endl; // 输出每个元素的大小
@@ -330,6 +336,8 @@ void perfPaxosImpl(oc::CLP &cmd)
 	{
 		Paxos<T> paxos;					// 创建Paxos对象
 		paxos.init(n, pp, block(i, i)); // 初始化Paxos
+		paxos.mDecodePrefetch = pf;		// 设置解码预取距离
+		paxos.mSpecializedDecode = !generic;
 
 		if (v > 1)				   // 如果需要详细输出
 			paxos.setTimer(timer); // 设置计时器
@@ -381,31 +389,559 @@ void perfPaxos(oc::CLP &cmd)
 	}
 }
 
-void perfOkvr(oc::CLP &cmd)
+/**
+ * @brief Paxos 各个内核的微基准测试。
+ *
+ * 对哈希、行构建(buildRow)、mod32、decode32 (特化与通用)/decode8/decode1、
+ * GF128 稠密部分以及 backfillGf128/backfillBinary 分别计时。每个基准先预热再重复执行，
+ * 输出中位数与 p99 的 ns/item 和 GB/s。
+ *
+ * @tparam IdxType 索引类型。
+ * @param cmd 命令行参数:
+ * - -n/-nn: 元素数量 (向下取整到 32 的倍数)。
+ * - -w, -ssp: Paxos 参数。
+ * - -warmup, -reps: 预热与重复次数。
+ * - -pin <core>: 将基准线程绑定到指定核心。
+ * - -csv / -json: 机器可读的输出格式。
+ * - -bench <names...>: 只运行以这些名字为前缀的基准。
+ */
+template <typename IdxType>
+void perfMicroImpl(oc::CLP &cmd)
 {
-	auto n = cmd.getOr("n", 1ull << cmd.getOr("nn", 10)); // 获取要处理的元素数量, 2^n
-	OkvrSender<u32> okvrS;
-	okvrS.init(n, block(1, 1));
+	auto n = cmd.getOr("n", 1ull << cmd.getOr("nn", 16)) / 32 * 32;
+	u64 maxN = std::numeric_limits<IdxType>::max() - 1;
+	auto w = cmd.getOr("w", 3);
+	auto ssp = cmd.getOr("ssp", 40);
+	auto opts = BenchOptions::fromCmd(cmd);
+
+	if (n == 0)
+		throw std::runtime_error("n must be at least 32. " LOCATION);
+
+	if (opts.mPin >= 0 && pinThread(opts.mPin) == false)
+		std::cout << "failed to pin thread to core " << opts.mPin << std::endl;
+
+	BenchReporter bench(opts);
+
+	std::vector<block> key(n), hash(n);
+	PRNG prng(ZeroBlock);
+	prng.get<block>(key);
+
+	// 哈希与行构建不依赖于稠密列的类型。
+	{
+		PaxosParam pp(n, w, ssp, PaxosParam::GF128);
+		if (maxN < pp.size())
+		{
+			std::cout << "n must be smaller than the index type max value. " LOCATION << std::endl;
+			throw RTE_LOC;
+		}
+
+		Paxos<IdxType> paxos;
+		paxos.init(n, pp, ZeroBlock);
+		auto &hasher = paxos.mHasher;
+		oc::Matrix<IdxType> rows(n, w);
+
+		bench.run("hash", n, n * sizeof(block), [&]
+				  { hasher.mAes.hashBlocks(key, hash); });
+
+		bench.run("buildRow32", n, n * sizeof(block), [&]
+				  {
+			for (u64 i = 0; i < n; i += 32)
+				hasher.buildRow32(&hash[i], rows[i].data()); });
+
+		bench.run("buildRow1", n, n * sizeof(block), [&]
+				  {
+			for (u64 i = 0; i < n; ++i)
+				hasher.buildRow(hash[i], rows[i].data()); });
+
+		bench.run("hashBuildRow32", n, n * sizeof(block), [&]
+				  {
+			for (u64 i = 0; i < n; i += 32)
+				hasher.hashBuildRow32(&key[i], rows[i].data(), &hash[i]); });
+
+		std::vector<u64> modSrc(n), modVals(n);
+		prng.get<u64>(modSrc);
+		bench.run(
+			"mod32", n, n * sizeof(u64), [&]
+			{
+			for (u64 i = 0; i < n; i += 32)
+				hasher.mod32(&modVals[i], 0); },
+			[&]
+			{ std::copy(modSrc.begin(), modSrc.end(), modVals.begin()); });
+	}
+
+	for (auto dt : {PaxosParam::GF128, PaxosParam::Binary})
+	{
+		std::string suffix = dt == PaxosParam::GF128 ? ".gf128" : ".binary";
+		PaxosParam pp(n, w, ssp, dt);
+		if (maxN < pp.size())
+		{
+			std::cout << "n must be smaller than the index type max value. " LOCATION << std::endl;
+			throw RTE_LOC;
+		}
+
+		Paxos<IdxType> paxos;
+		paxos.init(n, pp, ZeroBlock);
+
+		std::vector<block> val(n), pax(pp.size());
+		prng.get<block>(val);
+		prng.get<block>(pax);
+
+		oc::Matrix<IdxType> rows(n, w);
+		for (u64 i = 0; i < n; i += 32)
+			paxos.mHasher.hashBuildRow32(&key[i], rows[i].data(), &hash[i]);
+
+		// the dense size is what GF128 saves over binary, report it next to the decode cost.
+		// GF128 相比 binary 节省的是稠密部分的大小，将其与解码开销一起输出。
+		if (opts.mFormat == BenchOptions::Text)
+			std::cout << suffix.substr(1) << ": dense size " << pp.mDenseSize
+					  << ", okvs size " << pp.size() << " (" << double(pp.size()) / n << "n)" << std::endl;
+
+		PxVector<block> V(val);
+		PxVector<const block> P(pax);
+		auto h = P.defaultHelper();
+
+		bench.run("decode32" + suffix, n, n * sizeof(block), [&]
+				  {
+			for (u64 i = 0; i < n; i += 32)
+				paxos.decode32(rows[i].data(), &hash[i], V[i], P, h); });
+
+		paxos.mSpecializedDecode = false;
+		bench.run("decode32.generic" + suffix, n, n * sizeof(block), [&]
+				  {
+			for (u64 i = 0; i < n; i += 32)
+				paxos.decode32(rows[i].data(), &hash[i], V[i], P, h); });
+		paxos.mSpecializedDecode = true;
+
+		if (dt == PaxosParam::GF128)
+		{
+			// the dense part alone: batched powers with lazy reduction
+			// vs. one reduced multiplication per power and per row.
+			// 仅稠密部分：批量计算幂并延迟约减，对比每行每个幂做一次完整乘法。
+			std::vector<block> acc(n);
+			auto p2 = pax.data() + pp.mSparseSize;
+			bench.run("dense.gf128", n, n * sizeof(block), [&]
+					  {
+				for (u64 i = 0; i < n; i += 8)
+					gf128DenseMultAdd<8, 1>(&hash[i], p2, pp.mDenseSize, &acc[i]); });
+
+			bench.run("dense.gf128.ref", n, n * sizeof(block), [&]
+					  {
+				for (u64 i = 0; i < n; ++i)
+				{
+					block x = hash[i];
+					for (u64 j = 0; j < pp.mDenseSize; ++j)
+					{
+						if (j)
+							x = x.gf128Mul(hash[i]);
+						acc[i] = acc[i] ^ p2[j].gf128Mul(x);
+					}
+				} });
+		}
+
+		bench.run("decode8" + suffix, n, n * sizeof(block), [&]
+				  {
+			for (u64 i = 0; i < n; i += 8)
+				paxos.decode8(rows[i].data(), &hash[i], V[i], P, h); });
+
+		bench.run("decode1" + suffix, n, n * sizeof(block), [&]
+				  {
+			for (u64 i = 0; i < n; ++i)
+				paxos.decode1(rows[i].data(), &hash[i], V[i], P, h); });
+
+		// backfill only depends on the triangulation, which is computed once.
+		// backfill 只依赖三角化的结果，因此三角化只执行一次。
+		std::vector<IdxType> mainRows, mainCols;
+		std::vector<std::array<IdxType, 2>> gapRows;
+		paxos.setInput(key);
+		paxos.triangulate(mainRows, mainCols, gapRows);
+
+		PxVector<const block> X(val);
+		PxVector<block> out(pax);
+		auto ho = out.defaultHelper();
+		auto backfill = [&]
+		{
+			if (dt == PaxosParam::GF128)
+				paxos.backfillGf128(mainRows, mainCols, gapRows, X, out, ho, nullptr);
+			else
+				paxos.backfillBinary(mainRows, mainCols, gapRows, X, out, ho, nullptr);
+		};
+		bench.run(dt == PaxosParam::GF128 ? "backfillGf128" : "backfillBinary",
+				  n, n * sizeof(block), backfill, [&]
+				  { out.zerofill(); });
+	}
+
+	bench.finish();
+}
+
+void perfMicro(oc::CLP &cmd)
+{
+	auto bits = cmd.getOr("b", 32);
+	switch (bits)
+	{
+	case 16:
+		perfMicroImpl<u16>(cmd);
+		break;
+	case 32:
+		perfMicroImpl<u32>(cmd);
+		break;
+	case 64:
+		perfMicroImpl<u64>(cmd);
+		break;
+	default:
+		std::cout << "b must be 16, 32 or 64. " LOCATION << std::endl;
+		throw RTE_LOC;
+	}
+}
+
+/**
+ * @brief 增量更新的基准测试。
+ *
+ * 对 n 个键值完整求解一次，然后修改其中 frac 比例的值，比较 Paxos::updateValues 与重新求解的耗时，
+ * 并通过解码检查结果。随后向 Baxos 插入同样数量的新键，比较 resolveBins 与完整求解的耗时。
+ *
+ * @param cmd 命令行参数:
+ * - -n/-nn: 元素数量。
+ * - -frac <value>: 修改/插入的比例，默认 0.01。
+ * - -w, -ssp, -binary, -lbs: Paxos/Baxos 参数。
+ */
+void perfUpdate(oc::CLP &cmd)
+{
+	auto n = cmd.getOr("n", 1ull << cmd.getOr("nn", 16)); // 获取要处理的元素数量, 2^n
+	auto frac = cmd.getOr("frac", 0.01);				   // 修改的比例
+	auto w = cmd.getOr("w", 3);
+	auto ssp = cmd.getOr("ssp", 40);
+	auto dt = cmd.isSet("binary") ? PaxosParam::Binary : PaxosParam::GF128;
+	auto binSize = 1ull << cmd.getOr("lbs", 15);
+	auto numUpdates = std::max<u64>(1, u64(n * frac));
+
+	PaxosParam pp(n, w, ssp, dt);
+	std::vector<block> key(n), val(n), pax(pp.size()), dec(n);
+	PRNG prng(ZeroBlock);
+	prng.get<block>(key);
+	prng.get<block>(val);
+
+	Timer timer;
+	Paxos<u32> paxos;
+	paxos.init(n, pp, block(1, 1));
+	paxos.mRetainTriangulation = true;
+	auto start = timer.setTimePoint("start");
+	paxos.template solve<block>(key, oc::span<block>(val), oc::span<block>(pax));
+	auto solved = timer.setTimePoint("solve");
+
+	// 随机选择不重复的行并生成差值
+	std::unordered_set<u64> rowSet;
+	while (rowSet.size() < numUpdates)
+		rowSet.insert(prng.get<u64>() % n);
+	std::vector<u64> rows(rowSet.begin(), rowSet.end());
+	std::vector<block> delta(numUpdates);
+	prng.get<block>(delta);
+	for (u64 i = 0; i < numUpdates; ++i)
+		val[rows[i]] = val[rows[i]] ^ delta[i];
+
+	auto changed = paxos.template updateValues<block>(rows, delta, pax);
+	auto updated = timer.setTimePoint("update");
+
+	paxos.template decode<block>(key, oc::span<block>(dec), oc::span<const block>(pax));
+	if (dec != val)
+		throw std::runtime_error("updateValues(...) produced a wrong encoding. " LOCATION);
+
+	auto us = [](auto b, auto e)
+	{ return std::chrono::duration_cast<std::chrono::microseconds>(e - b).count() / double(1000); };
+	std::cout << "paxos n=" << n << " updates=" << numUpdates
+			  << " solve " << us(start, solved) << "ms"
+			  << " update " << us(solved, updated) << "ms"
+			  << " changed " << changed.size() << "/" << pax.size() << std::endl;
+
+	// Baxos: 插入新键，只重新求解受影响的箱
+	Baxos baxos;
+	baxos.init(n + numUpdates, binSize, w, ssp, dt, block(1, 1));
+	std::vector<block> bpax(baxos.size());
+	auto bKey = key, bVal = val;
+	bKey.resize(n);
+	bVal.resize(n);
+	baxos.template solve<block>(bKey, bVal, bpax, nullptr, 1);
+
+	std::vector<block> newKey(numUpdates), newVal(numUpdates);
+	prng.get<block>(newKey);
+	prng.get<block>(newVal);
+	bKey.insert(bKey.end(), newKey.begin(), newKey.end());
+	bVal.insert(bVal.end(), newVal.begin(), newVal.end());
+
+	auto bStart = timer.setTimePoint("baxos begin");
+	auto bins = baxos.getBins(newKey);
+	baxos.template resolveBins<block>(bKey, bVal, bpax, bins);
+	auto bResolved = timer.setTimePoint("baxos resolve");
+
+	std::vector<block> bDec(bKey.size());
+	baxos.template decode<block>(bKey, bDec, bpax, 1);
+	if (bDec != bVal)
+		throw std::runtime_error("resolveBins(...) produced a wrong encoding. " LOCATION);
+
+	auto bChecked = timer.setTimePoint("baxos check");
+	baxos.template solve<block>(bKey, bVal, bpax, nullptr, 1);
+	auto bSolved = timer.setTimePoint("baxos solve");
+
+	std::cout << "baxos n=" << n << " inserts=" << numUpdates
+			  << " solve " << us(bChecked, bSolved) << "ms"
+			  << " resolve " << us(bStart, bResolved) << "ms"
+			  << " bins " << bins.size() << "/" << baxos.mNumBins << std::endl;
+}
+
+// 读取输入集合：生成 n 行的 csv 文件（每 10 行有一行非 hex，需哈希）和二进制文件，测量 readSet 的时间
+// Reading the input set: writes a csv file with n lines (every 10th is not hex and gets hashed)
+// and a binary file, then times readSet with each thread count.
+void perfReadSet(oc::CLP &cmd)
+{
+	auto n = cmd.getOr("n", 1ull << cmd.getOr("nn", 20));
+	auto dir = cmd.getOr<std::string>("dir", "/tmp");
+	auto csvPath = dir + "/readSet_" + std::to_string(n) + ".csv";
+	auto binPath = dir + "/readSet_" + std::to_string(n) + ".bin";
+
+	std::vector<block> set(n);
+	PRNG prng(ZeroBlock);
+	prng.get<block>(set);
+	{
+		std::ofstream csv(csvPath, std::ios::out | std::ios::trunc);
+		std::ofstream bin(binPath, std::ios::out | std::ios::trunc | std::ios::binary);
+		if (!csv.is_open() || !bin.is_open())
+			throw std::runtime_error("failed to create the input files in " + dir + " " LOCATION);
+		for (u64 i = 0; i < n; ++i)
+		{
+			if (i % 10 == 9)
+				csv << "item" << i << "\n";
+			else
+				csv << set[i] << "\n";
+		}
+		bin.write((char *)set.data(), set.size() * sizeof(block));
+	}
+
+	auto ms = [](auto b, auto e)
+	{ return std::chrono::duration_cast<std::chrono::microseconds>(e - b).count() / double(1000); };
+	for (auto nt : cmd.getManyOr<u64>("nt", {1, 0}))
+	{
+		auto begin = std::chrono::steady_clock::now();
+		auto csvSet = readSet(csvPath, FileType::Csv, false, nt);
+		auto csvEnd = std::chrono::steady_clock::now();
+		auto binSet = readSet(binPath, FileType::Bin, false, nt);
+		auto binEnd = std::chrono::steady_clock::now();
+
+		if (csvSet.size() != n || binSet != set)
+			throw std::runtime_error("readSet(...) read a wrong set. " LOCATION);
+		for (u64 i = 0; i < n; ++i)
+			if (i % 10 != 9 && csvSet[i] != set[i])
+				throw std::runtime_error("readSet(...) parsed a wrong hex value. " LOCATION);
+
+		std::cout << "readSet n=" << n << " nt=" << nt
+				  << " csv " << ms(begin, csvEnd) << "ms"
+				  << " bin " << ms(csvEnd, binEnd) << "ms" << std::endl;
+	}
+
+	// 二进制文件的零拷贝视图 / zero copy view of the binary file
+	auto begin = std::chrono::steady_clock::now();
+	MappedFile file(binPath);
+	auto view = binarySetView(file);
+	block sum = ZeroBlock;
+	for (auto &b : view)
+		sum = sum ^ b;
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "readSet n=" << n << " bin view (map + one pass) " << ms(begin, end) << "ms " << (sum != ZeroBlock) << std::endl;
+
+	std::remove(csvPath.c_str());
+	std::remove(binPath.c_str());
+}
+
+// 一次完整的 OKVR 查询，okvrS 和 okvrR 已初始化，k 为每个 PIR 条目打包的编码位置数
+// One full OKVR round on initialized parties, k encoding positions are packed into each PIR entry.
+template <typename Sender, typename Recv>
+void perfOkvrRound(Sender &okvrS, Recv &okvrR, u64 n, u64 k)
+{
+	auto encodeBegin = std::chrono::steady_clock::now();
 	okvrS.setKeysAndValues();
 	okvrS.paxosEncoding();
+	auto encodeEnd = std::chrono::steady_clock::now();
 
-	OkvrRecv<u32> okvrR;
-	okvrR.init(n, block(1, 1));
 	okvrR.setKeysAndValues();
+	// 期望值，解码后检查 / the expected values, checked after decoding
+	auto expected = okvrR.mValues;
 
-	auto serverHash = okvrS.getServerHash();
-	okvrR.setServerHashMap(serverHash);
+	// 每一步使用独立的 SEAL 内存池，统计该步分配的字节数，用于检查是否有多余的密文/密钥复制
+	// Every step allocates from a fresh SEAL pool, the byte counts show unneeded ciphertext/key copies.
+	auto countAlloc = [](auto &&f) {
+		auto pool = seal::MemoryPoolHandle::New();
+		{
+			seal::MMProfGuard guard(std::make_unique<seal::MMProfFixed>(pool));
+			f();
+		}
+		return u64(pool.alloc_byte_count());
+	};
+	auto report = [k](const char *step, u64 bytes) {
+		std::cout << "okvr k=" << k << " " << step << " seal alloc " << bytes / 1024 << " KB" << std::endl;
+	};
+	auto us = [](auto b, auto e)
+	{ return std::chrono::duration_cast<std::chrono::microseconds>(e - b).count() / double(1000); };
+
+	// PIR 参数、哈希表和稠密部分（明文）由发送方给出
+	// The PIR parameters, the map and the dense part (in the clear) come from the sender.
+	okvrR.setServerParams(okvrS.getParams());
+	okvrR.setDense(okvrS.getDense());
 
-	auto pks = okvrR.getPublicKeys();
-	okvrS.setClientKeys(0, pks);
+	// 哈希表和密钥只传引用，密钥在服务器端只保存一份
+	// The map and the keys are passed by reference, the server stores the keys once.
+	report("set map", countAlloc([&] { okvrR.setServerHashMap(okvrS.getServerHash()); }));
+	report("set keys", countAlloc([&] { okvrS.setClientKeys(0, okvrR.getPublicKeys()); }));
 
+	// 每个键至多 w 个稀疏位置，按 PIR 批大小分批查询
+	// At most w sparse positions per key, queried in PIR batches.
 	auto indexes = okvrR.computeIndeies();
-	auto queies = okvrR.genQueies(indexes);
-	auto responses = okvrS.genResponse(0, queies);
+	auto batches = okvrR.splitBatches(indexes);
 
-	auto answers = okvrR.answer(responses);
+	u64 precomputeBytes = 0, queryBytes = 0, responseBytes = 0, answerBytes = 0;
+	double responseMs = 0;
+	for (auto &batch : batches)
+	{
+		vector<PIRQuery> queies;
+		PIRResponseList responses;
+		precomputeBytes += countAlloc([&] { okvrR.precomputeQueries(1); });
+		queryBytes += countAlloc([&] { queies = okvrR.genQueies(batch); });
+		auto begin = std::chrono::steady_clock::now();
+		responseBytes += countAlloc([&] { responses = okvrS.genResponse(0, queies); });
+		responseMs += us(begin, std::chrono::steady_clock::now());
+		answerBytes += countAlloc([&] { okvrR.answer(responses); });
+	}
+	report("precompute", precomputeBytes);
+	report("queries", queryBytes);
+	report("response", responseBytes);
+	report("answer", answerBytes);
 
 	okvrR.paxosDecoding();
+	if (okvrR.mValues != expected)
+		throw std::runtime_error("okvr decoded wrong values. " LOCATION);
+
+	std::cout << "okvr n=" << n << " k=" << k
+			  << " entries " << okvrS.getParams().get_num_entries()
+			  << " entry " << okvrS.getParams().get_entry_size() << "B"
+			  << " db " << okvrS.getParams().get_num_entries() * okvrS.getParams().get_entry_size() / 1024 << "KB"
+			  << " fetched " << indexes.size()
+			  << " batches " << batches.size()
+			  << " dense " << okvrS.getDense().size() << " (" << okvrS.getDense().size() * sizeof(okvrS.getDense()[0]) << "B)"
+			  << " encode " << us(encodeBegin, encodeEnd) << "ms"
+			  << " response " << responseMs << "ms" << std::endl;
+}
+
+// 在模拟的链路上运行 OKVR 网络协议，统计端到端时间和通信量。两方各在一个线程中运行。
+// Run the OKVR protocol over an emulated link, report the end-to-end time and the traffic.
+// Each party runs on its own thread.
+template <typename ValueType>
+void perfOkvrNet(u64 n, u64 k, const NetworkModel &model)
+{
+	OkvrSender<u32, ValueType> okvrS;
+	OkvrRecv<u32, ValueType> okvrR;
+	okvrS.init(n, block(1, 1), k);
+	okvrR.init(n, block(1, 1));
+
+	okvrS.setKeysAndValues();
+	okvrS.paxosEncoding();
+	okvrR.setKeysAndValues();
+	auto expected = okvrR.mValues;
+
+	auto begin = std::chrono::steady_clock::now();
+	auto socks = EmulatedSocket::makePair(model);
+	std::exception_ptr senderError;
+	std::thread senderThread([&] {
+		try
+		{
+			macoro::sync_wait(okvrS.run(socks[0]));
+		}
+		catch (...)
+		{
+			senderError = std::current_exception();
+			socks[0].close();
+		}
+	});
+	try
+	{
+		macoro::sync_wait(okvrR.run(socks[1]));
+	}
+	catch (...)
+	{
+		socks[1].close();
+		senderThread.join();
+		throw;
+	}
+	senderThread.join();
+	if (senderError)
+		std::rethrow_exception(senderError);
+	okvrR.paxosDecoding();
+	auto end = std::chrono::steady_clock::now();
+
+	if (okvrR.mValues != expected)
+		throw std::runtime_error("okvr decoded wrong values. " LOCATION);
+
+	std::cout << "okvr net " << model.name() << " n=" << n << " k=" << k << " vw=" << sizeof(ValueType)
+			  << " time " << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count() << "ms"
+			  << " sent " << socks[0].bytesSent() / 1024 << " KB"
+			  << " received " << socks[0].bytesReceived() / 1024 << " KB" << std::endl;
+}
+
+// 值类型为 ValueType 的 OKVR 测试，PIR 条目大小为 k * sizeof(ValueType)
+// The OKVR benchmark with ValueType values, the PIR entries are k * sizeof(ValueType) bytes.
+template <typename ValueType>
+void perfOkvrValues(oc::CLP &cmd)
+{
+	auto n = cmd.getOr("n", 1ull << cmd.getOr("nn", 10)); // 获取要处理的元素数量, 2^n
+	auto bin = cmd.isSet("bin");						  // 使用 Baxos / use Baxos
+	auto binSize = 1ull << cmd.getOr("lbs", 15);
+	auto nt = cmd.getOr("nt", 0);
+
+	// 依次测试每个打包因子 / benchmark each packing factor in turn
+	for (auto k : cmd.getManyOr<u64>("k", {1}))
+	{
+		if (cmd.isSet("net"))
+		{
+			// 默认测试不限速、1 Gbps/1 ms 和 10 Mbps/80 ms 的链路
+			// Unlimited, 1 Gbps/1 ms and 10 Mbps/80 ms links unless one is given.
+			std::vector<NetworkModel> models{{0, 0, 0}, {1000, 1, 0}, {10, 80, 0}};
+			if (cmd.isSet("mbps") || cmd.isSet("rtt"))
+				models = {{cmd.getOr("mbps", 0.0), cmd.getOr("rtt", 0.0), cmd.getOr("jitter", 0.0)}};
+			for (auto &model : models)
+				perfOkvrNet<ValueType>(n, k, model);
+		}
+		else if (bin)
+		{
+			BaxosOkvrSender<ValueType> okvrS;
+			BaxosOkvrRecv<ValueType> okvrR;
+			okvrS.init(n, binSize, block(1, 1), k, nt);
+			okvrR.init(n, binSize, block(1, 1), nt);
+			perfOkvrRound(okvrS, okvrR, n, k);
+		}
+		else
+		{
+			OkvrSender<u32, ValueType> okvrS;
+			OkvrRecv<u32, ValueType> okvrR;
+			okvrS.init(n, block(1, 1), k);
+			okvrR.init(n, block(1, 1));
+			perfOkvrRound(okvrS, okvrR, n, k);
+		}
+	}
+}
+
+void perfOkvr(oc::CLP &cmd)
+{
+	// 值的宽度（字节） / the value width in bytes
+	switch (cmd.getOr("vw", 16))
+	{
+	case 4:
+		perfOkvrValues<u32>(cmd);
+		break;
+	case 8:
+		perfOkvrValues<u64>(cmd);
+		break;
+	case 16:
+		perfOkvrValues<block>(cmd);
+		break;
+	default:
+		throw std::runtime_error("-vw must be 4, 8 or 16. " LOCATION);
+	}
 }
 
 void perf(oc::CLP &cmd)
@@ -416,6 +952,16 @@ void perf(oc::CLP &cmd)
 		perfPaxos(cmd);
 	if (cmd.isSet("baxos"))
 		perfBaxos(cmd);
+	if (cmd.isSet("buildRow"))
+		perfBuildRow(cmd);
+	if (cmd.isSet("mod"))
+		perfMod(cmd);
+	if (cmd.isSet("micro"))
+		perfMicro(cmd);
+	if (cmd.isSet("update"))
+		perfUpdate(cmd);
+	if (cmd.isSet("readSet"))
+		perfReadSet(cmd);
 }
 
 void overflow(CLP &cmd)
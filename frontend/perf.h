@@ -14,6 +14,9 @@ void perfMod(oc::CLP &cmd);
 void perfBuildRow(oc::CLP &cmd);
 void perfPaxos(oc::CLP &cmd);
 void perfBaxos(oc::CLP &cmd);
+void perfMicro(oc::CLP &cmd);
+void perfUpdate(oc::CLP &cmd);
+void perfReadSet(oc::CLP &cmd);
 
 void perfOkvr(oc::CLP &cmd);
 
@@ -1,4 +1,5 @@
 #include <vector>
+#include <algorithm>
 
 #include "cryptoTools/Common/Timer.h"
 #include "cryptoTools/Common/Defines.h"
@@ -11,13 +12,161 @@
 
 #include "volePSI/PxUtil.h"
 #include "volePSI/Paxos.h"
+#include "volePSI/fileBased.h"
 
 namespace deadline
 {
     using namespace volePSI;
     using namespace oc;
 
-    template <typename IdxType>
+    // 哈希表每个消息包含的条目数
+    constexpr u64 OkvrMapChunkSize = 1 << 14;
+
+    // OKVR 使用的 BatchPIR 参数，发送方和接收方由稀疏部分大小、打包因子和值的宽度得到相同的参数
+    inline BatchPirParams makeOkvrParams(u64 sparseSize, u64 packing, u64 valueBytes = sizeof(block))
+    {
+        if (packing == 0)
+            throw RTE_LOC;
+        u64 batchSize = 128, entrySize = valueBytes * packing;
+        u64 numEntries = oc::divCeil(sparseSize, packing);
+        // 将输入选择转换为字符串
+        string selection = std::to_string(batchSize) + "," + std::to_string(numEntries) + "," + std::to_string(entrySize);
+        // 创建加密参数，并初始化 BatchPirParams
+        auto encryption_params = utils::create_encryption_parameters(selection);
+        return BatchPirParams(batchSize, numEntries, entrySize, encryption_params);
+    }
+
+    // SEAL 对象（密文、密钥）与字节串的转换，用于网络传输
+    template <typename T>
+    std::vector<u8> sealToBytes(const T &obj)
+    {
+        std::vector<u8> buf(obj.save_size());
+        auto size = obj.save(reinterpret_cast<seal::seal_byte *>(buf.data()), buf.size());
+        buf.resize(size);
+        return buf;
+    }
+
+    template <typename T>
+    void sealFromBytes(const seal::SEALContext &context, T &obj, const std::vector<u8> &buf)
+    {
+        obj.load(context, reinterpret_cast<const seal::seal_byte *>(buf.data()), buf.size());
+    }
+
+    // 解析至多 2 * valueBytes 位的 hex 值（高位在前），以小端写入 out[0, valueBytes)
+    inline void parseHexValue(oc::span<const char> hex, u64 valueBytes, u8 *out)
+    {
+        if (hex.size() == 0 || hex.size() > 2 * valueBytes)
+            throw std::runtime_error("bad value \"" + std::string(hex.begin(), hex.end()) + "\", expecting at most " +
+                                     std::to_string(2 * valueBytes) + " hex digits. " LOCATION);
+        memset(out, 0, valueBytes);
+        // 从最低位开始，第 k 位写入第 k / 2 个字节
+        for (u64 k = 0; k < hex.size(); ++k)
+        {
+            auto c = hex[hex.size() - 1 - k];
+            u8 d;
+            if (c >= '0' && c <= '9')
+                d = c - '0';
+            else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+                d = (c | 0x20) - 'a' + 10;
+            else
+                throw std::runtime_error("bad value \"" + std::string(hex.begin(), hex.end()) + "\", not hex. " LOCATION);
+            out[k / 2] |= d << (4 * (k & 1));
+        }
+    }
+
+    // 从文件读取键值对，多线程直接写入 keys/values，记录数必须等于 keys.size()。
+    //   FileType::Csv: 每行 "key,value"。key 与 readSet 相同：32 位 hex 直接解析，否则哈希；
+    //                  value 为至多 2 * valueBytes 位的 hex。
+    //   FileType::Bin: 定长记录，16 字节的键后跟 valueBytes 字节的值（小端）。
+    // 值写入 ValueType 的低 valueBytes 字节，其余为零。读取后检查重复键，重复时抛出 DuplicateKeyError。
+    template <typename ValueType>
+    void loadKeyValueFile(const std::string &path, FileType ft, u64 valueBytes, u64 numThreads,
+                          oc::span<block> keys, oc::span<ValueType> values)
+    {
+        if (valueBytes == 0 || valueBytes > sizeof(ValueType))
+            throw std::runtime_error("value width must be 1 to " + std::to_string(sizeof(ValueType)) + " bytes. " LOCATION);
+        if (keys.size() != values.size())
+            throw RTE_LOC;
+
+        MappedFile file(path);
+        auto wrongCount = [&](u64 count)
+        {
+            return std::runtime_error(path + " has " + std::to_string(count) + " records, expecting " +
+                                      std::to_string(keys.size()) + ". " LOCATION);
+        };
+
+        if (ft == FileType::Bin)
+        {
+            u64 recordSize = sizeof(block) + valueBytes;
+            if (file.size() % recordSize)
+                throw std::runtime_error("Bad file size. Expecting " + std::to_string(recordSize) + " byte records. " LOCATION);
+            if (file.size() / recordSize != keys.size())
+                throw wrongCount(file.size() / recordSize);
+
+            if (numThreads == 0)
+                numThreads = std::max<u64>(1, std::thread::hardware_concurrency());
+            numThreads = std::max<u64>(1, std::min<u64>(numThreads, keys.size() / (1 << 16)));
+            auto data = file.data().data();
+            parallelFor(numThreads, [&](u64 t)
+                        {
+                u64 begin = keys.size() * t / numThreads, end = keys.size() * (t + 1) / numThreads;
+                for (u64 i = begin; i < end; ++i)
+                {
+                    auto record = data + i * recordSize;
+                    memcpy(&keys[i], record, sizeof(block));
+                    values[i] = ValueType{};
+                    memcpy(&values[i], record + sizeof(block), valueBytes);
+                } });
+        }
+        else if (ft == FileType::Csv)
+        {
+            numThreads = numTextThreads(numThreads, file.size());
+            auto chunks = splitLines(file.data(), numThreads);
+
+            // 先统计每块的行数得到写入位置，再解析
+            std::vector<u64> offset(numThreads + 1);
+            parallelFor(numThreads, [&](u64 t)
+                        { offset[t + 1] = countLines(chunks[t]); });
+            for (u64 t = 0; t < numThreads; ++t)
+                offset[t + 1] += offset[t];
+            if (offset.back() != keys.size())
+                throw wrongCount(offset.back());
+
+            parallelFor(numThreads, [&](u64 t)
+                        {
+                oc::RandomOracle hash(sizeof(block));
+                auto iter = chunks[t].data();
+                auto end = iter + chunks[t].size();
+                for (u64 i = offset[t]; i < offset[t + 1]; ++i)
+                {
+                    auto next = (const char *)memchr(iter, '\n', end - iter);
+                    if (next == nullptr)
+                        next = end;
+                    auto valueEnd = next > iter && next[-1] == '\r' ? next - 1 : next;
+
+                    // 值中不含逗号，按最后一个逗号分割，键可以包含逗号
+                    auto comma = valueEnd;
+                    while (comma > iter && comma[-1] != ',')
+                        --comma;
+                    if (comma == iter)
+                        throw std::runtime_error("line " + std::to_string(i) + " of " + path + " is not \"key,value\". " LOCATION);
+
+                    lineToBlock({iter, comma - 1}, hash, keys[i]);
+                    values[i] = ValueType{};
+                    parseHexValue({comma, valueEnd}, valueBytes, (u8 *)&values[i]);
+                    iter = next + 1;
+                } });
+        }
+        else
+            throw std::runtime_error("unknown file type. " LOCATION);
+
+        // 在 solve 之前报告重复键及其记录下标
+        checkDuplicateKeys(keys, numThreads, LOCATION);
+    }
+
+    // ValueType 为值的类型：block、u64、u32 或 PxBytes<N>，PIR 条目大小为 k * sizeof(ValueType)
+    // 非 block 的值没有 GF128 稠密类型，使用 Binary，明文发送的稠密部分多 40 个值，见 PaxosParam::defaultDenseType
+    template <typename IdxType, typename ValueType = block>
     class OkvrSender
     {
     public:
@@ -28,18 +177,22 @@ namespace deadline
 
         // Paxos Data
         std::vector<block> mKeys;
-        std::vector<block> mValues;
-        std::vector<block> mEncoding;
+        std::vector<ValueType> mValues;
+        std::vector<ValueType> mEncoding;
+
+        // 每个 PIR 条目包含的连续编码位置数 k
+        u64 mPacking = 1;
 
         OkvrSender() {};
 
-        void init(u64 numItems, block seed)
+        // packing: 每 k 个连续的稀疏位置打包为一个 PIR 条目（条目大小 k * sizeof(ValueType) 字节），减小数据库维度
+        void init(u64 numItems, block seed, u64 packing = 1)
         {
             /*
             初始化 Paoxs
             */
-            // 默认 w=3,denseType为GF128,统计参数为40
-            PaxosParam pp(numItems);
+            // 默认 w=3,统计参数为40；block 值使用 GF128 稠密类型，较窄的值使用 Binary
+            PaxosParam pp(numItems, 3, 40, PaxosParam::defaultDenseType<ValueType>());
 
             mKeys.resize(numItems);
             mValues.resize(numItems);
@@ -54,16 +207,15 @@ namespace deadline
             }
 
             mPaxos.init(numItems, pp, seed);
+            // 保留三角化结果，以便 updateValues 增量更新编码
+            mPaxos.mRetainTriangulation = true;
 
             /*
             初始化BatchPIR
+            稠密部分与密钥无关，每个接收方都需要全部稠密位置，因此明文发送；PIR 数据库只包含稀疏部分
             */
-            u64 batchSize = 128, entrySize = 16;
-            // 将输入选择转换为字符串
-            string selection = std::to_string(batchSize) + "," + std::to_string(mPaxos.size()) + "," + std::to_string(entrySize);
-            // 创建加密参数，并初始化 BatchPirParams
-            auto encryption_params = utils::create_encryption_parameters(selection);
-            BatchPirParams params(batchSize, mPaxos.size(), entrySize, encryption_params);
+            auto params = makeOkvrParams(mPaxos.mSparseSize, packing, sizeof(ValueType));
+            mPacking = packing;
             params.print_params();
 
             mServer = BatchPIRServer(params);
@@ -73,32 +225,168 @@ namespace deadline
         {
             PRNG prng(ZeroBlock); // 初始化随机数生成器
             prng.get<block>(mKeys);
-            prng.get<block>(mValues);
+            prng.get<ValueType>(mValues);
+        };
+
+        // 从文件读取 numItems 个键值对，见 loadKeyValueFile
+        void loadKeysAndValues(const std::string &path, FileType ft, u64 valueBytes = sizeof(ValueType), u64 numThreads = 0)
+        {
+            loadKeyValueFile<ValueType>(path, ft, valueBytes, numThreads, mKeys, mValues);
         };
 
         void paxosEncoding()
         {
-            mPaxos.template solve<block>(mKeys, oc::span<block>(mValues), oc::span<block>(mEncoding)); // 执行求解
-            mServer.setEntries((uint8_t *)mEncoding.data());
+            mPaxos.template solve<ValueType>(mKeys, oc::span<ValueType>(mValues), oc::span<ValueType>(mEncoding)); // 执行求解
+            // 只有前 mSparseSize 个位置进入 PIR 数据库，第 e 个条目为位置 [ek, ek+k)，最后一个条目补零
+            u64 numEntries = oc::divCeil(mPaxos.mSparseSize, mPacking);
+            std::vector<ValueType> packed(numEntries * mPacking, ValueType{});
+            std::copy(mEncoding.begin(), mEncoding.begin() + mPaxos.mSparseSize, packed.begin());
+            mServer.setEntries((uint8_t *)packed.data());
+        };
+
+        // 稠密部分 mEncoding[mSparseSize..]，明文发送给接收方
+        oc::span<const ValueType> getDense() const
+        {
+            return oc::span<const ValueType>(mEncoding).subspan(mPaxos.mSparseSize);
         };
 
-        std::unordered_map<std::string, u64> getServerHash()
+        // 更新部分键对应的值：只重新计算受影响的编码位置，并只重新编码包含这些位置的PIR桶。
+        // idxs 为 mKeys 中的下标，values 为新值。返回改变的编码位置。
+        std::vector<u64> updateValues(oc::span<const u64> idxs, oc::span<const ValueType> values)
+        {
+            if (idxs.size() != values.size())
+                throw RTE_LOC;
+
+            // 编码是线性的，只需对新旧值之差求解
+            std::vector<ValueType> delta(idxs.size());
+            for (u64 i = 0; i < idxs.size(); ++i)
+            {
+                delta[i] = mValues[idxs[i]] ^ values[i];
+                mValues[idxs[i]] = values[i];
+            }
+
+            auto changed = mPaxos.template updateValues<ValueType>(idxs, delta, mEncoding);
+
+            // 稠密位置不在 PIR 数据库中，改变后需重新发送 getDense()
+            std::vector<u64> changedEntries;
+            for (u64 i = 0; i < changed.size(); ++i)
+            {
+                if (changed[i] < mPaxos.mSparseSize)
+                    changedEntries.push_back(changed[i] / mPacking);
+            }
+            std::sort(changedEntries.begin(), changedEntries.end());
+            changedEntries.erase(std::unique(changedEntries.begin(), changedEntries.end()), changedEntries.end());
+
+            std::vector<ValueType> entries(changedEntries.size() * mPacking, ValueType{});
+            for (u64 i = 0; i < changedEntries.size(); ++i)
+            {
+                auto begin = changedEntries[i] * mPacking;
+                auto end = std::min<u64>(begin + mPacking, mPaxos.mSparseSize);
+                std::copy(mEncoding.begin() + begin, mEncoding.begin() + end, entries.begin() + i * mPacking);
+            }
+            mServer.update_entries(changedEntries, (uint8_t *)entries.data());
+
+            return changed;
+        };
+
+        const std::unordered_map<std::string, u64> &getServerHash() const
         {
             return mServer.get_hash_map();
         };
 
-        void setClientKeys(u32 client_id, std::pair<seal::GaloisKeys, seal::RelinKeys> public_Key)
+        // 编码后的参数（包含最大桶大小），接收方应使用该参数构造客户端
+        const BatchPirParams &getParams() const
+        {
+            return mServer.get_params();
+        };
+
+        // 密钥只保存一份，由所有子服务器共享；传入右值可避免复制
+        void setClientKeys(u32 client_id, const ClientKeys &public_Key)
         {
             mServer.set_client_keys(client_id, public_Key);
         }
 
-        PIRResponseList genResponse(u32 client_id, vector<PIRQuery> queries)
+        void setClientKeys(u32 client_id, ClientKeys &&public_Key)
+        {
+            mServer.set_client_keys(client_id, std::move(public_Key));
+        }
+
+        PIRResponseList genResponse(u32 client_id, const vector<PIRQuery> &queries)
         {
             return mServer.generate_response(client_id, queries);
         };
+
+        // 网络协议的发送方，需先调用 paxosEncoding。消息顺序：
+        //   S->R: 打包因子和最大桶大小、稠密部分、哈希表（分块）
+        //   R->S: Galois 密钥、重线性化密钥、批数
+        //   每批 R->S: 查询（每个密文一个消息），S->R: 压缩的响应（每个密文一个消息）
+        // 接收方在等待第 i 批响应前已发送第 i+1 批查询，因此响应计算与查询生成和传输重叠。
+        Proto run(Socket &sock)
+        {
+            std::vector<u64> header{mPacking, getParams().get_max_bucket_size()};
+            co_await sock.send(std::move(header));
+            auto dense = getDense();
+            co_await sock.send(std::vector<ValueType>(dense.begin(), dense.end()));
+
+            // 哈希表：每个条目为 键长度(u32)、键、值(u64)
+            auto &map = getServerHash();
+            co_await sock.send(u64(map.size()));
+            std::vector<u8> chunk;
+            u64 count = 0;
+            for (auto &kv : map)
+            {
+                u32 len = kv.first.size();
+                u64 value = kv.second;
+                auto pos = chunk.size();
+                chunk.resize(pos + sizeof(len) + len + sizeof(value));
+                memcpy(&chunk[pos], &len, sizeof(len));
+                memcpy(&chunk[pos + sizeof(len)], kv.first.data(), len);
+                memcpy(&chunk[pos + sizeof(len) + len], &value, sizeof(value));
+                if (++count == OkvrMapChunkSize)
+                {
+                    co_await sock.send(std::move(chunk));
+                    chunk = {};
+                    count = 0;
+                }
+            }
+            if (count)
+                co_await sock.send(std::move(chunk));
+
+            auto &context = mServer.get_context();
+            std::vector<u8> buf;
+            ClientKeys keys;
+            co_await sock.recvResize(buf);
+            sealFromBytes(context, keys.first, buf);
+            co_await sock.recvResize(buf);
+            sealFromBytes(context, keys.second, buf);
+            setClientKeys(0, std::move(keys));
+
+            u64 numBatches = 0;
+            co_await sock.recv(numBatches);
+            for (u64 b = 0; b < numBatches; ++b)
+            {
+                std::vector<u64> sizes;
+                co_await sock.recvResize(sizes);
+                vector<PIRQuery> queries(sizes.size());
+                for (u64 q = 0; q < sizes.size(); ++q)
+                {
+                    queries[q].resize(sizes[q]);
+                    for (auto &ct : queries[q])
+                    {
+                        co_await sock.recvResize(buf);
+                        sealFromBytes(context, ct, buf);
+                    }
+                }
+
+                auto responses = mServer.generate_compressed_response(0, queries);
+                co_await sock.send(u64(responses.size()));
+                for (auto &response : responses)
+                    co_await sock.send(std::move(response));
+            }
+        }
     };
 
-    template <typename IdxType>
+    template <typename IdxType, typename ValueType = block>
     class OkvrRecv
     {
     public:
@@ -108,15 +396,18 @@ namespace deadline
         block paxosKey;
 
         std::vector<block> mKeys;
-        std::vector<block> mValues;
-        std::vector<block> mEncoding;
+        std::vector<ValueType> mValues;
+        std::vector<ValueType> mEncoding;
+
+        // 每个 PIR 条目包含的连续编码位置数，由 setServerParams 设置
+        u64 mPacking = 1;
 
         OkvrRecv() {};
 
         void init(u64 numItems, block seed)
         {
-            // 默认 w=3,denseType为GF128,统计参数为40
-            PaxosParam pp(numItems);
+            // 默认 w=3,统计参数为40；block 值使用 GF128 稠密类型，较窄的值使用 Binary
+            PaxosParam pp(numItems, 3, 40, PaxosParam::defaultDenseType<ValueType>());
             mKeys.resize(numItems);
             mValues.resize(numItems);
             mEncoding.resize(pp.size());
@@ -130,16 +421,14 @@ namespace deadline
             }
 
             mPaxos.init(numItems, pp, seed);
+        };
 
-            /*
-            初始化BatchPIR
-            */
-            u64 batchSize = 128, entrySize = 16;
-            // 将输入选择转换为字符串
-            string selection = std::to_string(batchSize) + "," + std::to_string(mPaxos.size()) + "," + std::to_string(entrySize);
-            // 创建加密参数，并初始化 BatchPirParams
-            auto encryption_params = utils::create_encryption_parameters(selection);
-            BatchPirParams params(batchSize, mPaxos.size(), entrySize, encryption_params);
+        // BatchPIR 参数由发送方编码后给出（包含最大桶大小和打包因子），见 OkvrSender::getParams
+        void setServerParams(const BatchPirParams &params)
+        {
+            if (params.get_entry_size() % sizeof(ValueType))
+                throw RTE_LOC;
+            mPacking = params.get_entry_size() / sizeof(ValueType);
             mClient = BatchPIRClient(params);
         };
 
@@ -147,7 +436,7 @@ namespace deadline
         {
             PRNG prng(ZeroBlock); // 初始化随机数生成器
             prng.get<block>(mKeys);
-            prng.get<block>(mValues);
+            prng.get<ValueType>(mValues);
         };
 
         void setKeys() {
@@ -156,25 +445,41 @@ namespace deadline
 
         void paxosDecoding()
         {
-            mPaxos.template decode<block>(mKeys, oc::span<block>(mValues), oc::span<block>(mEncoding)); // 执行解码
+            mPaxos.template decode<ValueType>(mKeys, oc::span<ValueType>(mValues), oc::span<ValueType>(mEncoding)); // 执行解码
+        };
+
+        // 接收发送方明文发送的稠密部分
+        void setDense(oc::span<const ValueType> dense)
+        {
+            if (dense.size() != mPaxos.mDenseSize)
+                throw RTE_LOC;
+            std::copy(dense.begin(), dense.end(), mEncoding.begin() + mPaxos.mSparseSize);
         };
 
-        void setServerHashMap(std::unordered_map<std::string, u64> map)
+        void setServerHashMap(const std::unordered_map<std::string, u64> &map)
         {
             mClient.set_map(map);
         };
 
-        std::pair<seal::GaloisKeys, seal::RelinKeys> getPublicKeys()
+        void setServerHashMap(std::unordered_map<std::string, u64> &&map)
+        {
+            mClient.set_map(std::move(map));
+        };
+
+        const ClientKeys &getPublicKeys() const
         {
             return mClient.get_public_keys();
         }
 
+        // 解码 mKeys 需要的稀疏位置所在的 PIR 条目（升序、无重复），每个键至多 mWeight 个；
+        // 稠密部分明文获得，不需要 PIR。位置 p 位于条目 p / mPacking 的第 p % mPacking 个块
         vector<uint64_t> computeIndeies()
         {
-            auto paxosSize = mPaxos.size();
-            vector<IdxType> results(paxosSize, 0);
+            auto sparseSize = mPaxos.mSparseSize;
+            auto weight = mPaxos.mWeight;
+            vector<u8> used(oc::divCeil(sparseSize, mPacking), 0);
 
-            oc::Matrix<IdxType> rows(32, mPaxos.mWeight);
+            oc::Matrix<IdxType> rows(32, weight);
             vector<block> dense(32);
 
             auto inIter = mKeys.data();
@@ -183,41 +488,453 @@ namespace deadline
             for (u64 i = 0; i < main; i += 32, inIter += 32)
             {
                 mPaxos.mHasher.hashBuildRow32(inIter, rows.data(), dense.data());
-                for (u64 j = 0; j < 32; i++)
-                {
-                    results[rows(j, 0) - 1] = 1;
-                    results[rows(j, 1) - 1] = 1;
-                    results[rows(j, 2) - 1] = 1;
-                }
+                for (u64 j = 0; j < 32; ++j)
+                    for (u64 k = 0; k < weight; ++k)
+                        used[rows(j, k) / mPacking] = 1;
             }
 
             for (u64 i = main; i < mKeys.size(); ++i, ++inIter)
             {
                 mPaxos.mHasher.hashBuildRow1(inIter, rows.data(), dense.data());
-                results[rows(i, 0) - 1] = 1;
-                results[rows(i, 1) - 1] = 1;
-                results[rows(i, 2) - 1] = 1;
+                for (u64 k = 0; k < weight; ++k)
+                    used[rows(0, k) / mPacking] = 1;
+            }
+
+            vector<uint64_t> indeies;
+            for (u64 i = 0; i < used.size(); i++)
+            {
+                if (used[i])
+                    indeies.push_back(i);
             }
+            return indeies;
+        }
+
+        // 将位置按 PIR 批大小分批，最后一批用本批已有的位置补齐
+        vector<vector<uint64_t>> splitBatches(const vector<uint64_t> &indeies) const
+        {
+            auto batchSize = mClient.get_params().get_batch_size();
+            vector<vector<uint64_t>> batches;
+            for (u64 i = 0; i < indeies.size(); i += batchSize)
+            {
+                auto end = std::min<u64>(i + batchSize, indeies.size());
+                batches.emplace_back(indeies.begin() + i, indeies.begin() + end);
+                batches.back().resize(batchSize, indeies[i]);
+            }
+            return batches;
+        }
+
+        // 离线预计算零的加密，之后的 genQueies 只需编码和相加
+        void precomputeQueries(u64 numBatches)
+        {
+            mClient.precompute_queries(numBatches);
+        };
+
+        vector<PIRQuery> genQueies(const vector<uint64_t> &indeies)
+        {
+            return mClient.create_queries(indeies);
+        };
+
+        // 解码最近一次 genQueies 的响应，并将每个条目的 k 个块写入 mEncoding 中对应的稀疏位置
+        void answer(const PIRResponseList &list)
+        {
+            setEntries(mClient.decode_responses_chunks(list));
+        }
 
-            vector<uint64_t> result2;
+        void answer(const CompressedResponseList &list)
+        {
+            setEntries(mClient.decode_compressed_responses(list));
+        }
 
-            for (u64 i = 0; i < paxosSize; i++)
+        // 网络协议的接收方，见 OkvrSender::run。需先调用 setKeysAndValues，结束后调用 paxosDecoding
+        Proto run(Socket &sock)
+        {
+            std::vector<u64> header(2);
+            co_await sock.recv(header);
+            auto params = makeOkvrParams(mPaxos.mSparseSize, header[0], sizeof(ValueType));
+            params.set_max_bucket_size(header[1]);
+            setServerParams(params);
+
+            // 先发送密钥，发送方在发送哈希表之后才读取
+            auto &keys = getPublicKeys();
+            co_await sock.send(sealToBytes(keys.first));
+            co_await sock.send(sealToBytes(keys.second));
+
+            std::vector<ValueType> dense(mPaxos.mDenseSize);
+            co_await sock.recv(dense);
+            setDense(dense);
+
+            u64 mapSize = 0;
+            co_await sock.recv(mapSize);
+            std::unordered_map<std::string, u64> map;
+            map.reserve(mapSize);
+            std::vector<u8> chunk;
+            while (map.size() < mapSize)
             {
-                if (results[i] == 1)
+                co_await sock.recvResize(chunk);
+                for (u64 pos = 0; pos < chunk.size();)
                 {
-                    result2.push_back(i);
+                    u32 len;
+                    u64 value;
+                    if (pos + sizeof(len) > chunk.size())
+                        throw RTE_LOC;
+                    memcpy(&len, &chunk[pos], sizeof(len));
+                    if (pos + sizeof(len) + len + sizeof(value) > chunk.size())
+                        throw RTE_LOC;
+                    memcpy(&value, &chunk[pos + sizeof(len) + len], sizeof(value));
+                    map.emplace(std::string((const char *)&chunk[pos + sizeof(len)], len), value);
+                    pos += sizeof(len) + len + sizeof(value);
                 }
             }
+            setServerHashMap(std::move(map));
+
+            auto batches = splitBatches(computeIndeies());
+            precomputeQueries(batches.size());
+            co_await sock.send(u64(batches.size()));
+
+            // 发送第 b 批查询并保存解码所需的状态
+            std::vector<BatchPIRClient::QueryState> states(batches.size());
+            auto sendQueries = [&](u64 b) -> Proto
+            {
+                auto queries = genQueies(batches[b]);
+                states[b] = mClient.get_query_state();
+                std::vector<u64> sizes;
+                for (auto &query : queries)
+                    sizes.push_back(query.size());
+                co_await sock.send(std::move(sizes));
+                for (auto &query : queries)
+                    for (auto &ct : query)
+                        co_await sock.send(sealToBytes(ct));
+            };
+
+            if (batches.size())
+                co_await sendQueries(0);
+            for (u64 b = 0; b < batches.size(); ++b)
+            {
+                if (b + 1 < batches.size())
+                    co_await sendQueries(b + 1);
+
+                u64 numResponses = 0;
+                co_await sock.recv(numResponses);
+                CompressedResponseList responses(numResponses);
+                for (auto &response : responses)
+                    co_await sock.recvResize(response);
+
+                mClient.set_query_state(std::move(states[b]));
+                answer(responses);
+            }
         }
 
-        vector<PIRQuery> genQueies(vector<uint64_t> indeies)
+        void setEntries(const vector<RawDB> &entriesList)
+        {
+            auto &keys = mClient.get_cuckoo_keys();
+            auto defaultValue = mClient.get_params().get_default_value();
+
+            u64 bucket = 0;
+            for (auto &entries : entriesList)
+            {
+                for (auto &entry : entries)
+                {
+                    if (bucket < keys.size() && keys[bucket] != defaultValue)
+                    {
+                        if (entry.size() != sizeof(ValueType) * mPacking)
+                            throw RTE_LOC;
+                        auto begin = keys[bucket] * mPacking;
+                        auto end = std::min<u64>(begin + mPacking, mPaxos.mSparseSize);
+                        memcpy(&mEncoding[begin], entry.data(), (end - begin) * sizeof(ValueType));
+                    }
+                    ++bucket;
+                }
+            }
+        }
+    };
+
+    // 基于 Baxos 的 OKVR：各箱并行求解（numThreads），每个箱的稀疏部分映射到一组固定的 PIR 桶。
+    // 接收方按箱分批，每批中每组的条目数不超过该组桶数/布谷鸟因子，因此布谷鸟哈希不会因负载不均而失败。
+    // 第 b 个箱的编码为 mEncoding[b * (S + D), (b + 1) * (S + D))，前 S 个为稀疏部分，后 D 个为稠密部分。
+    template <typename ValueType = block>
+    class BaxosOkvrSender
+    {
+    public:
+        Baxos mBaxos;
+        BatchPIRServer mServer;
+
+        std::vector<block> mKeys;
+        std::vector<ValueType> mValues;
+        std::vector<ValueType> mEncoding;
+
+        // 每个 PIR 条目包含的连续编码位置数 k，条目不跨箱
+        u64 mPacking = 1;
+        u64 mNumThreads = 0;
+
+        BaxosOkvrSender() {};
+
+        void init(u64 numItems, u64 binSize, block seed, u64 packing = 1, u64 numThreads = 0)
+        {
+            if (packing == 0)
+                throw RTE_LOC;
+
+            // 默认 w=3,统计参数为40；block 值使用 GF128 稠密类型，较窄的值使用 Binary
+            mBaxos.init(numItems, binSize, 3, 40, PaxosParam::defaultDenseType<ValueType>(), seed);
+            mKeys.resize(numItems);
+            mValues.resize(numItems);
+            mEncoding.resize(mBaxos.size());
+            mPacking = packing;
+            mNumThreads = numThreads;
+
+            u64 batchSize = 128, entrySize = sizeof(ValueType) * mPacking;
+            u64 entriesPerBin = oc::divCeil(mBaxos.mPaxosParam.mSparseSize, mPacking);
+            u64 numEntries = mBaxos.mNumBins * entriesPerBin;
+            string selection = std::to_string(batchSize) + "," + std::to_string(numEntries) + "," + std::to_string(entrySize);
+            auto encryption_params = utils::create_encryption_parameters(selection);
+            BatchPirParams params(batchSize, numEntries, entrySize, encryption_params);
+
+            // 每组由若干个相邻的箱组成，每组至少需要 num_hash_funcs 个桶
+            u64 maxGroups = params.get_total_buckets() / params.get_num_hash_funcs();
+            u64 binsPerGroup = oc::divCeil(mBaxos.mNumBins, maxGroups);
+            params.set_entries_per_group(entriesPerBin * binsPerGroup);
+            params.print_params();
+
+            mServer = BatchPIRServer(params);
+        };
+
+        void setKeysAndValues()
+        {
+            PRNG prng(ZeroBlock); // 初始化随机数生成器
+            prng.get<block>(mKeys);
+            prng.get<ValueType>(mValues);
+        };
+
+        // 从文件读取 numItems 个键值对，见 loadKeyValueFile
+        void loadKeysAndValues(const std::string &path, FileType ft, u64 valueBytes = sizeof(ValueType))
+        {
+            loadKeyValueFile<ValueType>(path, ft, valueBytes, mNumThreads, mKeys, mValues);
+        };
+
+        void paxosEncoding()
+        {
+            mBaxos.template solve<ValueType>(mKeys, oc::span<ValueType>(mValues), oc::span<ValueType>(mEncoding), nullptr, mNumThreads);
+
+            // 每个箱的稀疏部分按 k 打包为 entriesPerBin 个条目，箱内最后一个条目补零
+            auto sparseSize = mBaxos.mPaxosParam.mSparseSize;
+            auto binSize = sparseSize + mBaxos.mPaxosParam.mDenseSize;
+            auto binEntries = oc::divCeil(sparseSize, mPacking) * mPacking;
+            std::vector<ValueType> packed(mBaxos.mNumBins * binEntries, ValueType{});
+            for (u64 b = 0; b < mBaxos.mNumBins; ++b)
+            {
+                auto begin = mEncoding.begin() + b * binSize;
+                std::copy(begin, begin + sparseSize, packed.begin() + b * binEntries);
+            }
+            mServer.setEntries((uint8_t *)packed.data());
+        };
+
+        // 所有箱的稠密部分，按箱顺序拼接，明文发送给接收方
+        std::vector<ValueType> getDense() const
+        {
+            auto sparseSize = mBaxos.mPaxosParam.mSparseSize;
+            auto denseSize = mBaxos.mPaxosParam.mDenseSize;
+            std::vector<ValueType> dense(mBaxos.mNumBins * denseSize);
+            for (u64 b = 0; b < mBaxos.mNumBins; ++b)
+            {
+                auto begin = mEncoding.begin() + b * (sparseSize + denseSize) + sparseSize;
+                std::copy(begin, begin + denseSize, dense.begin() + b * denseSize);
+            }
+            return dense;
+        };
+
+        const BatchPirParams &getParams() const
+        {
+            return mServer.get_params();
+        };
+
+        const std::unordered_map<std::string, u64> &getServerHash() const
+        {
+            return mServer.get_hash_map();
+        };
+
+        void setClientKeys(u32 client_id, const ClientKeys &public_Key)
+        {
+            mServer.set_client_keys(client_id, public_Key);
+        }
+
+        void setClientKeys(u32 client_id, ClientKeys &&public_Key)
+        {
+            mServer.set_client_keys(client_id, std::move(public_Key));
+        }
+
+        PIRResponseList genResponse(u32 client_id, const vector<PIRQuery> &queries)
+        {
+            return mServer.generate_response(client_id, queries);
+        };
+    };
+
+    template <typename ValueType = block>
+    class BaxosOkvrRecv
+    {
+    public:
+        Baxos mBaxos;
+        BatchPIRClient mClient;
+
+        std::vector<block> mKeys;
+        std::vector<ValueType> mValues;
+        std::vector<ValueType> mEncoding;
+
+        u64 mPacking = 1;
+        u64 mNumThreads = 0;
+
+        BaxosOkvrRecv() {};
+
+        void init(u64 numItems, u64 binSize, block seed, u64 numThreads = 0)
+        {
+            mBaxos.init(numItems, binSize, 3, 40, PaxosParam::defaultDenseType<ValueType>(), seed);
+            mKeys.resize(numItems);
+            mValues.resize(numItems);
+            mEncoding.resize(mBaxos.size());
+            mNumThreads = numThreads;
+        };
+
+        void setKeysAndValues()
+        {
+            PRNG prng(ZeroBlock); // 初始化随机数生成器
+            prng.get<block>(mKeys);
+            prng.get<ValueType>(mValues);
+        };
+
+        // BatchPIR 参数由发送方编码后给出（包含最大桶大小、打包因子和桶的分组）
+        void setServerParams(const BatchPirParams &params)
+        {
+            if (params.get_entry_size() % sizeof(ValueType))
+                throw RTE_LOC;
+            mPacking = params.get_entry_size() / sizeof(ValueType);
+            mClient = BatchPIRClient(params);
+        };
+
+        // 接收所有箱的稠密部分，见 BaxosOkvrSender::getDense
+        void setDense(oc::span<const ValueType> dense)
+        {
+            auto sparseSize = mBaxos.mPaxosParam.mSparseSize;
+            auto denseSize = mBaxos.mPaxosParam.mDenseSize;
+            if (dense.size() != mBaxos.mNumBins * denseSize)
+                throw RTE_LOC;
+            for (u64 b = 0; b < mBaxos.mNumBins; ++b)
+                std::copy(dense.begin() + b * denseSize, dense.begin() + (b + 1) * denseSize,
+                          mEncoding.begin() + b * (sparseSize + denseSize) + sparseSize);
+        };
+
+        void setServerHashMap(const std::unordered_map<std::string, u64> &map)
+        {
+            mClient.set_map(map);
+        };
+
+        void setServerHashMap(std::unordered_map<std::string, u64> &&map)
+        {
+            mClient.set_map(std::move(map));
+        };
+
+        const ClientKeys &getPublicKeys() const
+        {
+            return mClient.get_public_keys();
+        }
+
+        // 解码 mKeys 需要的 PIR 条目（升序、无重复）。键先哈希到箱，其 mWeight 个位置都在该箱的稀疏部分，
+        // 与 Baxos::implDecodeBatch 相同
+        vector<uint64_t> computeIndeies()
+        {
+            auto sparseSize = mBaxos.mPaxosParam.mSparseSize;
+            auto entriesPerBin = oc::divCeil(sparseSize, mPacking);
+            vector<u8> used(mBaxos.mNumBins * entriesPerBin, 0);
+
+            AES hasher(mBaxos.mSeed);
+            Paxos<u64> paxos;
+            paxos.init(1, mBaxos.mPaxosParam, mBaxos.mSeed);
+            std::vector<u64> row(mBaxos.mWeight);
+
+            for (u64 i = 0; i < mKeys.size(); ++i)
+            {
+                auto h = hasher.hashBlock(mKeys[i]);
+                auto bin = mBaxos.modNumBins(h);
+                paxos.mHasher.buildRow(h, row.data());
+                for (u64 k = 0; k < mBaxos.mWeight; ++k)
+                    used[bin * entriesPerBin + row[k] / mPacking] = 1;
+            }
+
+            vector<uint64_t> indeies;
+            for (u64 i = 0; i < used.size(); i++)
+            {
+                if (used[i])
+                    indeies.push_back(i);
+            }
+            return indeies;
+        }
+
+        // 分批：每批中第 g 组的条目数不超过 get_group_capacity(g)，不足的批用本批已有的条目补齐
+        vector<vector<uint64_t>> splitBatches(const vector<uint64_t> &indeies) const
+        {
+            auto &params = mClient.get_params();
+            auto numGroups = params.get_num_groups();
+            std::vector<std::vector<uint64_t>> groups(numGroups);
+            for (auto i : indeies)
+                groups[params.get_group(i)].push_back(i);
+
+            std::vector<u64> next(numGroups, 0);
+            vector<vector<uint64_t>> batches;
+            for (u64 remaining = indeies.size(); remaining;)
+            {
+                vector<uint64_t> batch;
+                for (u64 g = 0; g < numGroups; ++g)
+                {
+                    auto take = std::min<u64>(params.get_group_capacity(g), groups[g].size() - next[g]);
+                    batch.insert(batch.end(), groups[g].begin() + next[g], groups[g].begin() + next[g] + take);
+                    next[g] += take;
+                    remaining -= take;
+                }
+                batch.resize(params.get_batch_size(), batch[0]);
+                batches.push_back(std::move(batch));
+            }
+            return batches;
+        }
+
+        void precomputeQueries(u64 numBatches)
+        {
+            mClient.precompute_queries(numBatches);
+        };
+
+        vector<PIRQuery> genQueies(const vector<uint64_t> &indeies)
         {
             return mClient.create_queries(indeies);
         };
 
-        vector<RawDB> answer(PIRResponseList list)
+        // 解码最近一次 genQueies 的响应，条目 e 属于第 e / entriesPerBin 个箱
+        void answer(const PIRResponseList &list)
         {
-            return mClient.decode_responses_chunks(list);
+            auto entriesList = mClient.decode_responses_chunks(list);
+            auto &keys = mClient.get_cuckoo_keys();
+            auto defaultValue = mClient.get_params().get_default_value();
+            auto sparseSize = mBaxos.mPaxosParam.mSparseSize;
+            auto binSize = sparseSize + mBaxos.mPaxosParam.mDenseSize;
+            auto entriesPerBin = oc::divCeil(sparseSize, mPacking);
+
+            u64 bucket = 0;
+            for (auto &entries : entriesList)
+            {
+                for (auto &entry : entries)
+                {
+                    if (bucket < keys.size() && keys[bucket] != defaultValue)
+                    {
+                        if (entry.size() != sizeof(ValueType) * mPacking)
+                            throw RTE_LOC;
+                        auto bin = keys[bucket] / entriesPerBin;
+                        auto begin = (keys[bucket] % entriesPerBin) * mPacking;
+                        auto end = std::min<u64>(begin + mPacking, sparseSize);
+                        memcpy(&mEncoding[bin * binSize + begin], entry.data(), (end - begin) * sizeof(ValueType));
+                    }
+                    ++bucket;
+                }
+            }
         }
+
+        void paxosDecoding()
+        {
+            mBaxos.template decode<ValueType>(mKeys, oc::span<ValueType>(mValues), oc::span<const ValueType>(mEncoding), mNumThreads);
+        };
     };
 }
\ No newline at end of file
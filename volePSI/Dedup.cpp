@@ -0,0 +1,150 @@
+#include "Dedup.h"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include "fileBased.h"
+
+namespace volePSI
+{
+    DuplicateKeyError::DuplicateKeyError(std::vector<DuplicateKey> duplicates, const std::string& where)
+        : std::runtime_error(
+            std::to_string(duplicates.size()) + " duplicate keys, the first at records " +
+            std::to_string(duplicates[0].mFirst) + " and " + std::to_string(duplicates[0].mSecond) + ". " + where)
+        , mDuplicates(std::move(duplicates))
+    {}
+
+    namespace
+    {
+        struct Entry
+        {
+            u64 mHash, mIdx;
+        };
+
+        // Equal keys have equal hashes. The keys may be structured (small
+        // integers, ...), so the bits are mixed before the top ones pick the
+        // partition.
+        inline u64 keyHash(const block& key)
+        {
+            u64 w[2];
+            std::memcpy(w, &key, sizeof(block));
+            auto h = (w[0] ^ (w[1] * 0x9E3779B97F4A7C15ull)) * 0xBF58476D1CE4E5B9ull;
+            return h ^ (h >> 31);
+        }
+
+        bool keyLess(const block& a, const block& b)
+        {
+            return std::memcmp(&a, &b, sizeof(block)) < 0;
+        }
+    }
+
+    std::vector<DuplicateKey> findDuplicateKeys(span<const block> keys, u64 numThreads)
+    {
+        auto n = keys.size();
+        if (n < 2)
+            return {};
+
+        // at least 64K keys per thread, small inputs do not even ask for the core count.
+        auto maxThreads = std::max<u64>(1, n >> 16);
+        if (numThreads == 0)
+            numThreads = maxThreads > 1 ? std::thread::hardware_concurrency() : 1;
+        numThreads = std::max<u64>(1, std::min<u64>(numThreads, maxThreads));
+
+        // about 4K entries per partition so that each sort stays in cache,
+        // and enough partitions to balance the threads. Fewer keys, such as
+        // the bins of Baxos, are sorted as a single partition.
+        u64 bits = oc::log2ceil(std::max<u64>(1, n >> 12));
+        if (numThreads > 1)
+            bits = std::max<u64>(bits, oc::log2ceil(numThreads * 8));
+        bits = std::min<u64>(16, bits);
+        u64 numParts = 1ull << bits;
+        auto part = [bits](u64 h) { return bits ? h >> (64 - bits) : 0; };
+
+        // histogram of each thread's range, then the scatter offsets.
+        std::vector<u64> counts(numThreads * numParts);
+        auto range = [&](u64 t) { return std::make_pair(n * t / numThreads, n * (t + 1) / numThreads); };
+        parallelFor(numThreads, [&](u64 t) {
+            auto c = counts.data() + t * numParts;
+            auto [begin, end] = range(t);
+            for (u64 i = begin; i < end; ++i)
+                ++c[part(keyHash(keys[i]))];
+        });
+
+        std::vector<u64> partBegin(numParts + 1);
+        u64 sum = 0;
+        for (u64 p = 0; p < numParts; ++p)
+        {
+            partBegin[p] = sum;
+            for (u64 t = 0; t < numThreads; ++t)
+            {
+                auto c = counts[t * numParts + p];
+                counts[t * numParts + p] = sum;
+                sum += c;
+            }
+        }
+        partBegin[numParts] = sum;
+
+        // thread t writes its range in order, so each partition is sorted by index within a hash.
+        std::vector<Entry> entries(n);
+        parallelFor(numThreads, [&](u64 t) {
+            auto c = counts.data() + t * numParts;
+            auto [begin, end] = range(t);
+            for (u64 i = begin; i < end; ++i)
+            {
+                auto h = keyHash(keys[i]);
+                entries[c[part(h)]++] = { h, i };
+            }
+        });
+
+        // sort each partition by hash, equal hashes are then sorted by key.
+        std::vector<std::vector<DuplicateKey>> found(numThreads);
+        parallelFor(numThreads, [&](u64 t) {
+            auto& out = found[t];
+            for (u64 p = numParts * t / numThreads; p < numParts * (t + 1) / numThreads; ++p)
+            {
+                auto begin = entries.begin() + partBegin[p];
+                auto end = entries.begin() + partBegin[p + 1];
+                std::sort(begin, end, [](const Entry& a, const Entry& b) {
+                    return a.mHash < b.mHash || (a.mHash == b.mHash && a.mIdx < b.mIdx);
+                    });
+
+                for (auto iter = begin; iter != end;)
+                {
+                    auto run = iter + 1;
+                    while (run != end && run->mHash == iter->mHash)
+                        ++run;
+
+                    if (run - iter > 1)
+                    {
+                        // the same hash, the rare case. Group by key, each group by index.
+                        std::stable_sort(iter, run, [&](const Entry& a, const Entry& b) {
+                            return keyLess(keys[a.mIdx], keys[b.mIdx]);
+                            });
+                        for (auto first = iter; first != run;)
+                        {
+                            auto next = first + 1;
+                            for (; next != run && keys[next->mIdx] == keys[first->mIdx]; ++next)
+                                out.push_back({ first->mIdx, next->mIdx });
+                            first = next;
+                        }
+                    }
+                    iter = run;
+                }
+            }
+        });
+
+        std::vector<DuplicateKey> ret;
+        for (auto& f : found)
+            ret.insert(ret.end(), f.begin(), f.end());
+        std::sort(ret.begin(), ret.end(), [](const DuplicateKey& a, const DuplicateKey& b) {
+            return a.mSecond < b.mSecond;
+            });
+        return ret;
+    }
+
+    void checkDuplicateKeys(span<const block> keys, u64 numThreads, const char* where)
+    {
+        auto duplicates = findDuplicateKeys(keys, numThreads);
+        if (duplicates.size())
+            throw DuplicateKeyError(std::move(duplicates), where);
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdexcept>
+#include <vector>
+#include "volePSI/Defines.h"
+
+namespace volePSI
+{
+	// Two records with the same key, mFirst is the first record with this key
+	// and mSecond a later one.
+	// 两条键相同的记录，mFirst 为该键的第一条记录，mSecond 为之后的一条。
+	struct DuplicateKey
+	{
+		u64 mFirst = 0, mSecond = 0;
+	};
+
+	// Thrown by Paxos/Baxos when the keys contain duplicates.
+	// Paxos/Baxos 的输入键有重复时抛出。
+	class DuplicateKeyError : public std::runtime_error
+	{
+	public:
+		std::vector<DuplicateKey> mDuplicates;
+
+		DuplicateKeyError(std::vector<DuplicateKey> duplicates, const std::string& where);
+	};
+
+	// Finds the keys that appear more than once. The keys are radix
+	// partitioned on a hash of the key, then each partition is sorted, both
+	// steps run on numThreads threads (0 for one per core). Returns one
+	// DuplicateKey per later occurrence, ordered by mSecond.
+	// 查找重复的键。先按键的哈希进行基数划分，再对每个分区排序，两步都用 numThreads 个线程（0 表示每核一个）。
+	// 每个重复出现的记录返回一个 DuplicateKey，按 mSecond 排序。
+	std::vector<DuplicateKey> findDuplicateKeys(span<const block> keys, u64 numThreads = 0);
+
+	// Throws DuplicateKeyError if the keys contain duplicates.
+	// 如果键有重复，抛出 DuplicateKeyError。
+	void checkDuplicateKeys(span<const block> keys, u64 numThreads = 0, const char* where = "");
+
+	// Removes the later occurrences listed in duplicates (as returned by
+	// findDuplicateKeys) from data, keeping the order of the rest. Call it
+	// with the keys and with each parallel array of values. Returns the new size.
+	// 从 data 中删除 duplicates（findDuplicateKeys 的结果）中的重复记录，其余记录保持顺序。
+	// 对键和每个对应的值数组分别调用。返回新的大小。
+	template<typename T>
+	u64 removeDuplicates(span<T> data, span<const DuplicateKey> duplicates)
+	{
+		u64 out = 0, d = 0;
+		for (u64 i = 0; i < data.size(); ++i)
+		{
+			if (d < duplicates.size() && duplicates[d].mSecond == i)
+			{
+				++d;
+				continue;
+			}
+			if (out != i)
+				data[out] = std::move(data[i]);
+			++out;
+		}
+		return out;
+	}
+}
@@ -21,6 +21,7 @@
 #include "cryptoTools/Crypto/RandomOracle.h"
 #include "libOTe/Tools/LDPC/Mtx.h"
 #include "volePSI/PxUtil.h"
+#include "volePSI/Dedup.h"
 
 namespace volePSI
 {
@@ -60,6 +61,21 @@ namespace volePSI
 		{
 			return mSparseSize + mDenseSize;
 		}
+
+		// GF128 for block values, Binary for the others (u32, u64, PxBytes<N>, ...).
+		// The GF128 dense columns multiply values by GF(2^128) elements, which is
+		// only implemented for block values. Binary needs ssp more dense columns,
+		// with ssp = 40 that is 42 instead of 2 dense values at n = 2^16 (41
+		// instead of 1 at n = 2^20), so e.g. 168 bytes of u32 instead of 32 bytes of blocks.
+		// block 值使用 GF128，其他值（u32、u64、PxBytes<N> 等）使用 Binary。
+		// GF128 稠密列将值与 GF(2^128) 元素相乘，只实现了 block 值。Binary 多需要 ssp 个稠密列，
+		// ssp = 40 时 n = 2^16 的稠密部分为 42 个值而不是 2 个（n = 2^20 为 41 个而不是 1 个），
+		// 例如 168 字节的 u32 而不是 32 字节的 block。
+		template<typename ValueType>
+		static DenseType defaultDenseType()
+		{
+			return std::is_same<std::remove_const_t<ValueType>, block>::value ? GF128 : Binary;
+		}
 	};
 
 	// The core Paxos algorithm. The template parameter
@@ -82,11 +98,45 @@ namespace volePSI
 		bool mVerbose = false;
 		bool mDebug = false;
 
+		// setInput checks the keys for duplicates and throws DuplicateKeyError
+		// with their indices, instead of failing later in triangulate.
+		// setInput 检查重复键并抛出带有下标的 DuplicateKeyError，而不是之后在三角化中失败。
+		bool mCheckDuplicates = true;
+
 		// when decoding, add the decoded value to the 
 		// output, as opposed to overwriting.
 		// 解码时，将解码值添加到输出，而不是覆盖。
 		bool mAddToDecode = false;
 
+		// when decoding, the number of 32-row batches that are hashed ahead of
+		// the batch currently being gathered. The rows of these batches are
+		// prefetched so that the random reads into the paxos are in flight
+		// while the current batch is processed. 0 disables the pipelining.
+		// 解码时，预先哈希的32行批次的数量。这些批次的行会被预取，
+		// 使得对Paxos的随机读取与当前批次的处理重叠。0表示不使用流水线。
+		u64 mDecodePrefetch = 2;
+
+		// when decoding block values with the default helpers, use the kernels
+		// where the weight and the number of block columns are compile time
+		// constants (w=3 with 1, 2 or 4 columns). Otherwise the generic decode32 is used.
+		// 解码block值且使用默认助手时，使用权重和block列数为编译期常量的内核
+		// (w=3，1、2或4列)。否则使用通用的decode32。
+		bool mSpecializedDecode = true;
+
+		// when set, encode(...) keeps the triangulation, i.e. the backfill order
+		// of the rows/columns and the gap rows, so that updateValues(...) can
+		// re-derive only the positions affected by a value change.
+		// 设置后，encode(...) 会保留三角化结果（行/列的回填顺序以及间隙行），
+		// 以便 updateValues(...) 只重新计算受值变化影响的位置。
+		bool mRetainTriangulation = false;
+
+		// the retained triangulation, see mRetainTriangulation. mRowPos[i] is the
+		// position of row i in the backfill order, or -1 if it is a gap row.
+		// 保留的三角化结果，参见 mRetainTriangulation。mRowPos[i] 是第i行在回填顺序中的位置，
+		// 若为间隙行则为 -1。
+		std::vector<IdxType> mMainRows, mMainCols, mRowPos;
+		std::vector<std::array<IdxType, 2>> mGapRows;
+
 		// the method for generating the row data based on the input value.
 		// 基于输入值生成行数据的方法。
 		PaxosHash<IdxType> mHasher;
@@ -229,6 +279,32 @@ namespace volePSI
 		template<typename Vec, typename ConstVec, typename Helper>
 		void encode(ConstVec& values, Vec& output, Helper& h, oc::PRNG* prng = nullptr);
 
+		// update the paxos p after the values of some inputs changed. rows are
+		// indices into the inputs given to setInput(...), delta[i] is the
+		// difference (xor) of the new and the old value of input rows[i]. p
+		// must have been encoded with mRetainTriangulation set. Returns the
+		// positions of p that changed. If the system has no gap rows only the
+		// rows that depend on the changed ones are visited, otherwise the delta
+		// is backfilled over the whole paxos. Since the encoding is linear, p
+		// stays a (random) solution for the new values.
+		// 在部分输入的值改变后更新Paxos p。rows是setInput(...)输入的下标，delta[i]是输入rows[i]
+		// 新值与旧值的差(异或)。p必须在设置mRetainTriangulation的情况下编码。返回p中改变的位置。
+		// 若没有间隙行，只访问依赖于改变行的行，否则对整个Paxos回填差值。由于编码是线性的，
+		// p仍然是新值的(随机)解。
+		template<typename ValueType>
+		std::vector<u64> updateValues(span<const u64> rows, span<const ValueType> delta, span<ValueType> p)
+		{
+			PxVector<const ValueType> D(delta);
+			PxVector<ValueType> P(p);
+			auto h = P.defaultHelper();
+			return updateValues(rows, D, P, h);
+		}
+
+		// update the paxos p after the values of some inputs changed. See above.
+		// 在部分输入的值改变后更新Paxos p。见上。
+		template<typename Vec, typename ConstVec, typename Helper>
+		std::vector<u64> updateValues(span<const u64> rows, ConstVec& delta, Vec& p, Helper& h);
+
 		// Decode the given input based on the data paxos structure p. The
 		// output is written to values.
 		// 根据数据Paxos结构p解码给定输入。输出写入值。
@@ -281,6 +357,20 @@ namespace volePSI
 		template<typename ValueType, typename Helper, typename Vec>
 		void decode32(const IdxType* rows, const block* dense, ValueType* values, Vec& p, Helper& h);
 
+		// decodes 32 instances where the weight and the number of block columns
+		// are compile time constants. p points to the Paxos, values is where
+		// the values are written to. Each value is Cols blocks.
+		// 解码32个实例，其中权重和block列数是编译期常量。p指向Paxos，values是写入值的地方。
+		// 每个值由Cols个block组成。
+		template<u64 Weight, u64 Cols>
+		void decode32Fixed(const IdxType* rows, const block* dense, block* values, const block* p);
+
+		// prefetch the paxos entries referenced by 32 rows. rows should
+		// contain the row indices, p is the Paxos, h is the value op. helper.
+		// 预取32行所引用的Paxos条目。rows应包含行索引，p是Paxos，h是值操作助手。
+		template<typename Helper, typename ConstVec>
+		void prefetch32(const IdxType* rows, ConstVec& p, Helper& h);
+
 		// decodes 8 instances. rows should contain the row indices, dense the dense 
 		// part. values is where the values are written to. p is the Paxos, h is the value op. helper.
 		// 解码8个实例。rows应包含行索引，dense为稠密部分。values是写入值的地方。p是Paxos，h是值操作助手。
@@ -462,6 +552,10 @@ namespace volePSI
 
 		bool mDebug = false;
 
+		// solve checks the keys for duplicates (in parallel) and throws DuplicateKeyError.
+		// solve 并行检查重复键并抛出 DuplicateKeyError。
+		bool mCheckDuplicates = true;
+
 		// when decoding, add the decoded value to the 
 		// output, as opposed to overwriting.
 		// 解码时，将解码值添加到输出，而不是覆盖。
@@ -527,6 +621,37 @@ namespace volePSI
 			u64 numThreads,
 			Helper& h);
 
+		// re-solve only the given bins. inputs and values are the complete,
+		// updated key value set and output is the existing paxos. Only the
+		// part of output that belongs to the given bins is rewritten. This is
+		// used to absorb a small number of key insertions/removals, see getBins(...).
+		// Throws if a bin overflows, a full solve is then required.
+		// 只重新求解给定的箱。inputs和values是完整的、更新后的键值集合，output是已有的Paxos。
+		// 只重写output中属于这些箱的部分。用于吸收少量键的插入/删除，参见getBins(...)。
+		// 若某个箱溢出则抛出异常，此时需要完整求解。
+		template<typename ValueType>
+		void resolveBins(
+			span<const block> inputs,
+			span<const ValueType> values,
+			span<ValueType> output,
+			span<const u64> bins,
+			oc::PRNG* prng = nullptr);
+
+		// re-solve only the given bins. See above.
+		// 只重新求解给定的箱。见上。
+		template<typename Vec, typename ConstVec, typename Helper>
+		void resolveBins(
+			span<const block> inputs,
+			ConstVec& values,
+			Vec& output,
+			span<const u64> bins,
+			oc::PRNG* prng,
+			Helper& h);
+
+		// returns the sorted, distinct bins that the given inputs map to.
+		// 返回给定输入映射到的箱 (已排序且去重)。
+		std::vector<u64> getBins(span<const block> inputs);
+
 		// decode a single input given the paxos p.
 		// 解码给定Paxos p的单个输入。
 		template<typename ValueType>
@@ -582,6 +707,17 @@ namespace volePSI
 			u64 numThreads,
 			Helper& h);
 
+		// re-solve the given bins.
+		// 重新求解给定的箱。
+		template<typename IdxType, typename Vec, typename ConstVec, typename Helper>
+		void implResolveBins(
+			span<const block> inputs,
+			ConstVec& values,
+			Vec& output,
+			span<const u64> bins,
+			oc::PRNG* prng,
+			Helper& h);
+
 		// create the desired number of threads and split up the work.
 		// 创建所需数量的线程并分配工作。
 		template<typename IdxType, typename Vec, typename ConstVec, typename Helper>
@@ -9,6 +9,8 @@
 // THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include <unordered_set>
+#include <unordered_map>
+#include <queue>
 #include <numeric>
 #include <future>
 
@@ -134,6 +136,17 @@ namespace volePSI
 		return Inv;
 	}
 
+	// throws if the GF128 dense type is used with values other than blocks,
+	// see PaxosParam::defaultDenseType.
+	// 如果非 block 值使用 GF128 稠密类型则抛出异常，见 PaxosParam::defaultDenseType。
+	template <typename Helper>
+	inline void checkDenseType(PaxosParam::DenseType dt)
+	{
+		if constexpr (!Helper::hasGf128)
+			if (dt == PaxosParam::GF128)
+				throw std::runtime_error("the GF128 dense type needs block values, use PaxosParam::Binary for other value types. " LOCATION);
+	}
+
 	inline Matrix<block> gf128Mul(const Matrix<block> &m0, const Matrix<block> &m1)
 	{
 		assert(m0.cols() == m1.rows());
@@ -773,15 +786,8 @@ namespace volePSI
 
 		std::vector<IdxType> colWeights(mSparseSize);
 
-#ifndef NDEBUG
-		{
-			std::unordered_set<block> inputSet;
-			for (auto i : inputs)
-			{
-				assert(inputSet.insert(i).second);
-			}
-		}
-#endif
+		if (mCheckDuplicates)
+			checkDuplicateKeys(inputs, 1, LOCATION);
 		setTimePoint("setInput alloc");
 
 		{
@@ -903,24 +909,47 @@ namespace volePSI
 	void Paxos<IdxType>::decode(span<const block> inputs, Vec &values, ConstVec &PP, Helper &h)
 	{
 		setTimePoint("decode begin");
+		checkDenseType<Helper>(mDt);
 
 		if (PP.size() != size())
 			throw RTE_LOC;
 
 		auto main = inputs.size() / gPaxosBuildRowSize * gPaxosBuildRowSize;
+		auto numBatches = main / gPaxosBuildRowSize;
+
+		// Software pipeline over the 32-row batches. Batch k + dist is hashed
+		// and its paxos entries are prefetched before batch k is gathered.
+		// The rows/dense of the in-flight batches live in a ring of depth
+		// dist + 1.
+		// 对32行批次进行软件流水线处理。在收集批次k之前，先哈希批次k+dist并预取其Paxos条目。
+		auto dist = std::min<u64>(mDecodePrefetch, numBatches);
+		auto depth = dist + 1;
+
+		Matrix<IdxType> rows(gPaxosBuildRowSize * depth, mWeight);
+		std::vector<block> dense(gPaxosBuildRowSize * depth);
+
+		auto hashBatch = [&](u64 b)
+		{
+			assert(gPaxosBuildRowSize == 32);
+			auto slot = (b % depth) * gPaxosBuildRowSize;
+			mHasher.hashBuildRow32(inputs.data() + b * gPaxosBuildRowSize, rows[slot].data(), &dense[slot]);
+			if (dist)
+				prefetch32(rows[slot].data(), PP, h);
+		};
 
-		auto inIter = inputs.data();
+		for (u64 b = 0; b < dist; ++b)
+			hashBatch(b);
 
-		Matrix<IdxType> rows(gPaxosBuildRowSize, mWeight);
-		std::vector<block> dense(gPaxosBuildRowSize);
 		if (mAddToDecode)
 		{
 			auto v = h.newVec(gPaxosBuildRowSize);
-			for (u64 i = 0; i < main; i += gPaxosBuildRowSize, inIter += gPaxosBuildRowSize)
+			for (u64 b = 0, i = 0; b < numBatches; ++b, i += gPaxosBuildRowSize)
 			{
-				assert(gPaxosBuildRowSize == 32);
-				mHasher.hashBuildRow32(inIter, rows.data(), dense.data());
-				decode32(rows.data(), dense.data(), v[0], PP, h);
+				if (b + dist < numBatches)
+					hashBatch(b + dist);
+
+				auto slot = (b % depth) * gPaxosBuildRowSize;
+				decode32(rows[slot].data(), &dense[slot], v[0], PP, h);
 				for (u64 j = 0; j < 32; j += 8)
 				{
 					h.add(values[i + j + 0], v[j + 0]);
@@ -934,6 +963,7 @@ namespace volePSI
 				}
 			}
 
+			auto inIter = inputs.data() + main;
 			for (u64 i = main; i < inputs.size(); ++i, ++inIter)
 			{
 				mHasher.hashBuildRow1(inIter, rows.data(), dense.data());
@@ -943,13 +973,16 @@ namespace volePSI
 		}
 		else
 		{
-			for (u64 i = 0; i < main; i += gPaxosBuildRowSize, inIter += gPaxosBuildRowSize)
+			for (u64 b = 0, i = 0; b < numBatches; ++b, i += gPaxosBuildRowSize)
 			{
-				assert(gPaxosBuildRowSize == 32);
-				mHasher.hashBuildRow32(inIter, rows.data(), dense.data());
-				decode32(rows.data(), dense.data(), values[i], PP, h);
+				if (b + dist < numBatches)
+					hashBatch(b + dist);
+
+				auto slot = (b % depth) * gPaxosBuildRowSize;
+				decode32(rows[slot].data(), &dense[slot], values[i], PP, h);
 			}
 
+			auto inIter = inputs.data() + main;
 			for (u64 i = main; i < inputs.size(); ++i, ++inIter)
 			{
 				mHasher.hashBuildRow1(inIter, rows.data(), dense.data());
@@ -960,6 +993,18 @@ namespace volePSI
 		setTimePoint("decode done");
 	}
 
+	template <typename IdxType>
+	template <typename Helper, typename ConstVec>
+	void Paxos<IdxType>::prefetch32(const IdxType *rows, ConstVec &PP, Helper &h)
+	{
+#ifdef ENABLE_SSE
+		// only the first cache line of each element is requested.
+		auto p = PP[0];
+		for (u64 i = 0; i < gPaxosBuildRowSize * mWeight; ++i)
+			_mm_prefetch((const char *)h.iterPlus(p, rows[i]), _MM_HINT_T0);
+#endif
+	}
+
 	template <typename IdxType>
 	void Paxos<IdxType>::setInput(
 		MatrixView<IdxType> rows,
@@ -1157,6 +1202,7 @@ namespace volePSI
 	template <typename Vec, typename ConstVec, typename Helper>
 	void Paxos<IdxType>::encode(ConstVec &values, Vec &output, Helper &h, PRNG *prng)
 	{
+		checkDenseType<Helper>(mDt);
 		if (static_cast<u64>(output.size()) != size())
 			throw RTE_LOC;
 
@@ -1186,6 +1232,150 @@ namespace volePSI
 		}
 
 		backfill(mainRows, mainCols, gapRows, values, output, h, prng);
+
+		if (mRetainTriangulation)
+		{
+			// row mainRows[j] is the (n-1-j)'th row to be backfilled.
+			// 行 mainRows[j] 是第 (n-1-j) 个被回填的行。
+			mRowPos.assign(mNumItems, IdxType(-1));
+			for (u64 j = 0; j < mainRows.size(); ++j)
+				mRowPos[mainRows[j]] = static_cast<IdxType>(mainRows.size() - 1 - j);
+
+			mMainRows = std::move(mainRows);
+			mMainCols = std::move(mainCols);
+			mGapRows = std::move(gapRows);
+		}
+	}
+
+	template <typename IdxType>
+	template <typename Vec, typename ConstVec, typename Helper>
+	std::vector<u64> Paxos<IdxType>::updateValues(span<const u64> rows, ConstVec &delta, Vec &p, Helper &h)
+	{
+		checkDenseType<Helper>(mDt);
+		if (static_cast<u64>(delta.size()) != rows.size())
+			throw RTE_LOC;
+		if (static_cast<u64>(p.size()) != size())
+			throw RTE_LOC;
+		if (mRowPos.size() != mNumItems)
+			throw std::runtime_error("updateValues(...) requires the paxos to be encoded with mRetainTriangulation set. " LOCATION);
+
+		// row index -> index into delta.
+		// 行下标 -> delta 的下标。
+		std::unordered_map<u64, u64> rowDelta;
+		rowDelta.reserve(rows.size());
+		for (u64 i = 0; i < rows.size(); ++i)
+		{
+			if (rows[i] >= mNumItems)
+				throw RTE_LOC;
+			if (rowDelta.emplace(rows[i], i).second == false)
+				throw std::runtime_error("updateValues(...) was given the same row twice. " LOCATION);
+		}
+
+		std::vector<u64> changed;
+		if (mGapRows.size())
+		{
+			// The gap rows couple every main row with the dense columns.
+			// Backfill the delta over the whole system instead. Without a
+			// prng the free columns stay zero and only the delta remains.
+			// 间隙行使每个主行都与稠密列耦合。此时对整个系统回填差值。
+			// 不使用prng时自由列保持为零，只剩下差值。
+			auto dX = h.newVec(mNumItems);
+			auto dP = h.newVec(size());
+			dX.zerofill();
+			dP.zerofill();
+			for (u64 i = 0; i < rows.size(); ++i)
+				h.assign(dX[rows[i]], delta[i]);
+
+			backfill(mMainRows, mMainCols, mGapRows, dX, dP, h, nullptr);
+
+			auto zz = h.newElement();
+			auto zero = h.asPtr(zz);
+			auto zVec = h.newVec(1);
+			zVec.zerofill();
+			h.assign(zero, zVec[0]);
+			for (u64 i = 0; i < size(); ++i)
+			{
+				if (h.eq(dP[i], zero) == false)
+				{
+					h.add(p[i], dP[i]);
+					changed.push_back(i);
+				}
+			}
+			return changed;
+		}
+
+		// Without gap rows the system is solved by back propagation. The main
+		// column c of a row is only read by the rows that contain c and are
+		// backfilled later. Starting from the changed rows, visit these
+		// dependent rows in backfill order and recompute their main column
+		// from the delta of their value and the deltas of their other columns.
+		// Rows whose delta cancels out are not propagated further.
+		// 没有间隙行时，系统通过回代求解。行的主列c只会被包含c且之后回填的行读取。
+		// 从改变的行开始，按回填顺序访问这些依赖行，并根据其值的差值及其他列的差值重新计算主列。
+		// 差值相互抵消的行不再继续传播。
+		auto n = mMainRows.size();
+		std::priority_queue<u64, std::vector<u64>, std::greater<u64>> queue;
+		std::unordered_set<u64> queued;
+		for (auto r : rows)
+		{
+			queue.push(mRowPos[r]);
+			queued.insert(mRowPos[r]);
+		}
+
+		// dP[t] is the delta of the t'th changed column. Not initialized,
+		// at most n columns can change.
+		// dP[t] 是第t个改变列的差值。未初始化，最多有n列改变。
+		auto dP = h.newVec(n);
+		std::unordered_map<u64, u64> colSlot;
+		auto zVec = h.newVec(1);
+		zVec.zerofill();
+
+		while (queue.size())
+		{
+			auto k = queue.top();
+			queue.pop();
+
+			auto j = n - 1 - k;
+			auto i = mMainRows[j];
+			auto c = mMainCols[j];
+			auto t = changed.size();
+			auto y = dP[t];
+
+			auto d = rowDelta.find(i);
+			if (d != rowDelta.end())
+				h.assign(y, delta[d->second]);
+			else
+				h.assign(y, zVec[0]);
+
+			auto row = mRows.data() + i * mWeight;
+			for (u64 w = 0; w < mWeight; ++w)
+			{
+				auto s = colSlot.find(row[w]);
+				if (s != colSlot.end())
+					h.add(y, dP[s->second]);
+			}
+
+			if (h.eq(y, zVec[0]))
+				continue;
+
+			colSlot.emplace(c, t);
+			h.add(p[c], y);
+			changed.push_back(c);
+
+			for (auto r2 : mCols[c])
+			{
+				if (r2 == i)
+					continue;
+
+				u64 k2 = mRowPos[r2];
+				assert(k2 > k);
+				if (queued.insert(k2).second)
+					queue.push(k2);
+			}
+		}
+
+		std::sort(changed.begin(), changed.end());
+		return changed;
 	}
 
 	template <typename IdxType>
@@ -1716,6 +1906,41 @@ namespace volePSI
 		Vec &p_,
 		Helper &h)
 	{
+		if constexpr (std::is_same<ValueType, block>::value)
+		{
+			// dispatch to a kernel with the weight and the number
+			// of columns fixed at compile time, if there is one.
+			// 如果存在权重与列数在编译期固定的内核，则使用它。
+			using H = std::remove_cv_t<Helper>;
+			u64 cols = 0;
+			if constexpr (
+				std::is_same<H, typename PxVector<const block>::Helper>::value ||
+				std::is_same<H, typename PxVector<block>::Helper>::value)
+				cols = 1;
+			else if constexpr (
+				std::is_same<H, typename PxMatrix<const block>::Helper>::value ||
+				std::is_same<H, typename PxMatrix<block>::Helper>::value)
+				cols = h.mCols;
+
+			if (mSpecializedDecode && mWeight == 3)
+			{
+				switch (cols)
+				{
+				case 1:
+					decode32Fixed<3, 1>(rows_, dense_, values_, p_[0]);
+					return;
+				case 2:
+					decode32Fixed<3, 2>(rows_, dense_, values_, p_[0]);
+					return;
+				case 4:
+					decode32Fixed<3, 4>(rows_, dense_, values_, p_[0]);
+					return;
+				default:
+					break;
+				}
+			}
+		}
+
 		//{
 		//	auto r = rows_;
 		//	auto d = dense_;
@@ -1988,6 +2213,80 @@ namespace volePSI
 		}
 	}
 
+	template <typename IdxType>
+	template <u64 Weight, u64 Cols>
+	void Paxos<IdxType>::decode32Fixed(
+		const IdxType *rows_,
+		const block *dense_,
+		block *values_,
+		const block *p_)
+	{
+		// the number of rows processed together. The accumulators
+		// of a group, R * Cols blocks, are kept in registers.
+		// 一起处理的行数。一组的累加器 (R * Cols 个block) 保存在寄存器中。
+		constexpr u64 R = Cols >= 8 ? 1 : 8 / Cols;
+		static_assert(32 % R == 0, "the group size must divide the batch size.");
+
+		const IdxType *__restrict rows = rows_;
+		const block *__restrict dense = dense_;
+		const block *__restrict p = p_;
+		const block *__restrict p2 = p_ + mSparseSize * Cols;
+		block *__restrict values = values_;
+
+		// sparse part: the sum of the Weight referenced entries. All 32 rows
+		// are gathered first so that the random reads are issued together.
+		// 稀疏部分：Weight个被引用条目之和。先收集全部32行，使随机读取能够同时发出。
+		for (u64 k = 0; k < 32; ++k)
+		{
+			auto row = rows + k * Weight;
+			std::array<block, Cols> acc;
+			for (u64 c = 0; c < Cols; ++c)
+				acc[c] = p[row[0] * Cols + c];
+			for (u64 j = 1; j < Weight; ++j)
+				for (u64 c = 0; c < Cols; ++c)
+					acc[c] = acc[c] ^ p[row[j] * Cols + c];
+			for (u64 c = 0; c < Cols; ++c)
+				values[k * Cols + c] = acc[c];
+		}
+
+		// dense part, R rows at a time.
+		// 稠密部分，每次处理R行。
+		for (u64 k = 0; k < 32; k += R)
+		{
+			std::array<block, R * Cols> acc;
+			for (u64 i = 0; i < R * Cols; ++i)
+				acc[i] = values[k * Cols + i];
+
+			if (mDt == DenseType::GF128)
+			{
+				gf128DenseMultAdd<R, Cols>(dense + k, p2, mDenseSize, acc.data());
+			}
+			else
+			{
+				assert(mDenseSize <= 64);
+				std::array<u64, R> d;
+				for (u64 r = 0; r < R; ++r)
+					d[r] = dense[k + r].get<u64>(0);
+
+				for (u64 i = 0; i < mDenseSize; ++i)
+				{
+					for (u64 r = 0; r < R; ++r)
+					{
+						// all ones if the i'th bit is set, zero otherwise.
+						// 若第i位为1则全为1，否则为0。
+						u64 bit = (d[r] >> i) & 1;
+						block mask(0 - bit, 0 - bit);
+						for (u64 c = 0; c < Cols; ++c)
+							acc[r * Cols + c] = acc[r * Cols + c] ^ (p2[i * Cols + c] & mask);
+					}
+				}
+			}
+
+			for (u64 i = 0; i < R * Cols; ++i)
+				values[k * Cols + i] = acc[i];
+		}
+	}
+
 	template <typename IdxType>
 	template <typename ValueType, typename Helper, typename Vec>
 	void Paxos<IdxType>::decode8(
@@ -2571,6 +2870,8 @@ namespace volePSI
 		u64 numThreads,
 		Helper &h)
 	{
+		checkDenseType<Helper>(mPaxosParam.mDt);
+
 		// select the smallest index type which will work.
 		auto bitLength = oc::roundUpTo(oc::log2ceil((u64)(mPaxosParam.mSparseSize + 1)), 8);
 
@@ -2596,15 +2897,8 @@ namespace volePSI
 		u64 numThreads,
 		Helper &h)
 	{
-#ifndef NDEBUG
-		{
-			std::unordered_set<block> inputSet;
-			for (u64 i = 0; i < inputs_.size(); ++i)
-			{
-				assert(inputSet.insert(inputs_[i]).second);
-			}
-		}
-#endif
+		if (mCheckDuplicates)
+			checkDuplicateKeys(inputs_, numThreads, LOCATION);
 		if (p_.size() != size())
 			throw RTE_LOC;
 
@@ -2612,6 +2906,8 @@ namespace volePSI
 		{
 			Paxos<IdxType> paxos;
 			paxos.init(mNumItems, mPaxosParam, mSeed);
+			// already checked above
+			paxos.mCheckDuplicates = false;
 			paxos.setInput(inputs_);
 			paxos.encode(vals_, p_, h, prng);
 
@@ -2892,6 +3188,127 @@ namespace volePSI
 			thrds[i].join();
 	}
 
+	inline std::vector<u64> Baxos::getBins(span<const block> inputs)
+	{
+		AES hasher(mSeed);
+		std::vector<u64> bins(inputs.size());
+		for (u64 i = 0; i < inputs.size(); ++i)
+			bins[i] = mNumBins == 1 ? 0 : modNumBins(hasher.hashBlock(inputs[i]));
+
+		std::sort(bins.begin(), bins.end());
+		bins.erase(std::unique(bins.begin(), bins.end()), bins.end());
+		return bins;
+	}
+
+	template <typename ValueType>
+	void Baxos::resolveBins(
+		span<const block> inputs,
+		span<const ValueType> values,
+		span<ValueType> output,
+		span<const u64> bins,
+		PRNG *prng)
+	{
+		PxVector<const ValueType> V(values);
+		PxVector<ValueType> P(output);
+		auto h = P.defaultHelper();
+		resolveBins(inputs, V, P, bins, prng, h);
+	}
+
+	template <typename Vec, typename ConstVec, typename Helper>
+	void Baxos::resolveBins(
+		span<const block> inputs,
+		ConstVec &V,
+		Vec &P,
+		span<const u64> bins,
+		PRNG *prng,
+		Helper &h)
+	{
+		auto bitLength = oc::roundUpTo(oc::log2ceil((u64)(mPaxosParam.mSparseSize + 1)), 8);
+
+		if (bitLength <= 8)
+			implResolveBins<u8>(inputs, V, P, bins, prng, h);
+		else if (bitLength <= 16)
+			implResolveBins<u16>(inputs, V, P, bins, prng, h);
+		else if (bitLength <= 32)
+			implResolveBins<u32>(inputs, V, P, bins, prng, h);
+		else
+			implResolveBins<u64>(inputs, V, P, bins, prng, h);
+	}
+
+	template <typename IdxType, typename Vec, typename ConstVec, typename Helper>
+	void Baxos::implResolveBins(
+		span<const block> inputs,
+		ConstVec &vals,
+		Vec &p,
+		span<const u64> bins,
+		PRNG *prng,
+		Helper &h)
+	{
+		if (static_cast<u64>(vals.size()) != inputs.size())
+			throw RTE_LOC;
+		if (static_cast<u64>(p.size()) != size())
+			throw RTE_LOC;
+
+		// the position of each selected bin in bins, -1 if not selected.
+		// 每个被选中的箱在bins中的位置，未选中则为 -1。
+		std::vector<u64> binSlot(mNumBins, ~0ull);
+		for (u64 i = 0; i < bins.size(); ++i)
+		{
+			if (bins[i] >= mNumBins)
+				throw RTE_LOC;
+			binSlot[bins[i]] = i;
+		}
+
+		// gather the items of the selected bins. Only these are re-solved,
+		// the rest of the paxos is left untouched.
+		// 收集被选中箱中的元素。只重新求解这些箱，Paxos的其余部分保持不变。
+		std::vector<std::vector<u64>> binItems(bins.size());
+		AES hasher(mSeed);
+		std::array<block, 8> hashes;
+		for (u64 i = 0; i < inputs.size(); i += 8)
+		{
+			auto k = std::min<u64>(8, inputs.size() - i);
+			if (k == 8)
+				hasher.hashBlocks<8>(inputs.data() + i, hashes.data());
+			else
+				for (u64 j = 0; j < k; ++j)
+					hashes[j] = hasher.hashBlock(inputs[i + j]);
+
+			for (u64 j = 0; j < k; ++j)
+			{
+				auto binIdx = mNumBins == 1 ? 0 : modNumBins(hashes[j]);
+				if (binSlot[binIdx] != ~0ull)
+					binItems[binSlot[binIdx]].push_back(i + j);
+			}
+		}
+
+		auto paxosSizePer = mPaxosParam.size();
+		std::vector<block> binInputs;
+		Paxos<IdxType> paxos;
+		for (u64 i = 0; i < bins.size(); ++i)
+		{
+			auto &items = binItems[i];
+			if (items.size() > mItemsPerBin)
+				throw std::runtime_error("Baxos bin overflow, a full solve is required. " LOCATION);
+
+			binInputs.resize(items.size());
+			auto binValues = h.newVec(items.size());
+			for (u64 j = 0; j < items.size(); ++j)
+			{
+				binInputs[j] = inputs[items[j]];
+				h.assign(binValues[j], vals[items[j]]);
+			}
+
+			// the bin paxos hashes with the same seed and therefore
+			// reproduces the rows the full solve used.
+			// 箱内Paxos使用相同的种子哈希，因此会重现完整求解时使用的行。
+			paxos.init(items.size(), mPaxosParam, mSeed);
+			paxos.setInput(binInputs);
+			auto output = p.subspan(paxosSizePer * bins[i], paxosSizePer);
+			paxos.encode(binValues, output, h, prng);
+		}
+	}
+
 	template <typename ValueType>
 	void Baxos::decode(span<const block> inputs, span<ValueType> values, span<const ValueType> p, u64 numThreads)
 	{
@@ -2945,6 +3362,7 @@ namespace volePSI
 		Helper &h,
 		u64 numThreads)
 	{
+		checkDenseType<Helper>(mPaxosParam.mDt);
 		auto bitLength = oc::roundUpTo(oc::log2ceil((u64)(mPaxosParam.mSparseSize + 1)), 8);
 		if (bitLength <= 8)
 			implParDecode<u8>(inputs, V, P, h, numThreads);
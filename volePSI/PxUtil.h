@@ -504,6 +504,172 @@ namespace volePSI
 
 	};
 
+	// Batched GF(2^128) arithmetic used by the dense part of the decoder.
+	// Gf128Lanes holds N field elements, one per 128 bit lane, and
+	// multiplies them without reducing so that products can be summed
+	// before a single reduction. With VPCLMULQDQ two rows are processed
+	// per instruction, otherwise the block methods are used one row at a time.
+	// 解码器稠密部分使用的批量GF(2^128)运算。Gf128Lanes 在每个128位通道中保存一个域元素，
+	// 共N个，相乘时不做约减，使乘积可以先求和再统一约减。支持VPCLMULQDQ时每条指令处理两行，
+	// 否则使用block的方法逐行处理。
+#if defined(ENABLE_SSE) && defined(__VPCLMULQDQ__) && defined(__AVX2__)
+	struct Gf128Lanes
+	{
+		static constexpr u64 N = 2;
+		__m256i mData;
+
+		static Gf128Lanes zero() { return { _mm256_setzero_si256() }; }
+		static Gf128Lanes load(const block* p) { return { _mm256_loadu_si256((const __m256i*)p) }; }
+		static Gf128Lanes broadcast(const block& b) { return { _mm256_broadcastsi128_si256(b) }; }
+		void store(block* p) const { _mm256_storeu_si256((__m256i*)p, mData); }
+
+		Gf128Lanes operator^(const Gf128Lanes& o) const { return { _mm256_xor_si256(mData, o.mData) }; }
+
+		// the unreduced 256 bit product, lo and hi halves.
+		// 未约减的256位乘积，分为低位和高位两半。
+		void mul(const Gf128Lanes& y, Gf128Lanes& lo, Gf128Lanes& hi) const
+		{
+			auto t1 = _mm256_clmulepi64_epi128(mData, y.mData, 0x00);
+			auto t2 = _mm256_clmulepi64_epi128(mData, y.mData, 0x10);
+			auto t3 = _mm256_clmulepi64_epi128(mData, y.mData, 0x01);
+			auto t4 = _mm256_clmulepi64_epi128(mData, y.mData, 0x11);
+			t2 = _mm256_xor_si256(t2, t3);
+			lo.mData = _mm256_xor_si256(t1, _mm256_slli_si256(t2, 8));
+			hi.mData = _mm256_xor_si256(t4, _mm256_srli_si256(t2, 8));
+		}
+
+		// reduce lo, hi modulo x^128 + x^7 + x^2 + x + 1. Matches block::gf128Reduce.
+		// 对 x^128 + x^7 + x^2 + x + 1 约减 lo, hi。与 block::gf128Reduce 一致。
+		static Gf128Lanes reduce(Gf128Lanes lo, Gf128Lanes hi)
+		{
+			const __m256i modulus = _mm256_set1_epi64x(0b10000111);
+			auto tmp = _mm256_clmulepi64_epi128(hi.mData, modulus, 0x01);
+			lo.mData = _mm256_xor_si256(lo.mData, _mm256_slli_si256(tmp, 8));
+			hi.mData = _mm256_xor_si256(hi.mData, _mm256_srli_si256(tmp, 8));
+			tmp = _mm256_clmulepi64_epi128(hi.mData, modulus, 0x00);
+			return { _mm256_xor_si256(lo.mData, tmp) };
+		}
+	};
+#else
+	struct Gf128Lanes
+	{
+		static constexpr u64 N = 1;
+		block mData;
+
+		static Gf128Lanes zero() { return { oc::ZeroBlock }; }
+		static Gf128Lanes load(const block* p) { return { *p }; }
+		static Gf128Lanes broadcast(const block& b) { return { b }; }
+		void store(block* p) const { *p = mData; }
+
+		Gf128Lanes operator^(const Gf128Lanes& o) const { return { mData ^ o.mData }; }
+
+		void mul(const Gf128Lanes& y, Gf128Lanes& lo, Gf128Lanes& hi) const
+		{
+			mData.gf128Mul(y.mData, lo.mData, hi.mData);
+		}
+
+		static Gf128Lanes reduce(Gf128Lanes lo, Gf128Lanes hi)
+		{
+			return { lo.mData.gf128Reduce(hi.mData) };
+		}
+	};
+#endif
+
+	// For each of the R rows, add sum_i p2[i] * dense[r]^(i+1), i < denseSize, to
+	// the Cols blocks of acc[r * Cols, ..., r * Cols + Cols - 1]. This is the GF128
+	// dense contribution of a paxos row. The powers of the R rows are computed
+	// together and the products are accumulated unreduced, so each output
+	// block is reduced once instead of denseSize times.
+	// 对R行中的每一行，将 sum_i p2[i] * dense[r]^(i+1) (i < denseSize) 加到
+	// acc[r * Cols, ..., r * Cols + Cols - 1] 的Cols个block上。这是Paxos行的GF128稠密部分。
+	// R行的幂同时计算，乘积以未约减形式累加，因此每个输出block只约减一次，而不是denseSize次。
+	template<u64 R, u64 Cols>
+	inline void gf128DenseMultAdd(const block* dense, const block* p2, u64 denseSize, block* acc)
+	{
+		using L = Gf128Lanes;
+		static_assert(R % L::N == 0, "the number of rows must be a multiple of the lane count.");
+		constexpr u64 V = R / L::N;
+
+		std::array<L, V> d, x;
+		std::array<L, V * Cols> lo, hi;
+		for (u64 v = 0; v < V; ++v)
+		{
+			d[v] = L::load(dense + v * L::N);
+			x[v] = d[v];
+		}
+		for (u64 i = 0; i < V * Cols; ++i)
+			lo[i] = hi[i] = L::zero();
+
+		for (u64 i = 0; i < denseSize; ++i)
+		{
+			if (i)
+			{
+				for (u64 v = 0; v < V; ++v)
+				{
+					L l, h;
+					x[v].mul(d[v], l, h);
+					x[v] = L::reduce(l, h);
+				}
+			}
+
+			for (u64 c = 0; c < Cols; ++c)
+			{
+				auto pc = L::broadcast(p2[i * Cols + c]);
+				for (u64 v = 0; v < V; ++v)
+				{
+					L l, h;
+					pc.mul(x[v], l, h);
+					lo[v * Cols + c] = lo[v * Cols + c] ^ l;
+					hi[v * Cols + c] = hi[v * Cols + c] ^ h;
+				}
+			}
+		}
+
+		for (u64 v = 0; v < V; ++v)
+		{
+			for (u64 c = 0; c < Cols; ++c)
+			{
+				std::array<block, L::N> t;
+				L::reduce(lo[v * Cols + c], hi[v * Cols + c]).store(t.data());
+				for (u64 l = 0; l < L::N; ++l)
+				{
+					auto& a = acc[(v * L::N + l) * Cols + c];
+					a = a ^ t[l];
+				}
+			}
+		}
+	}
+
+	// A value of N bytes, for Paxos values whose width is not 4, 8 or 16
+	// bytes. It has no padding, so a span<PxBytes<N>> is N bytes per value.
+	// Needs the binary dense type, see PaxosParam::defaultDenseType.
+	// N 字节的值，用于宽度不是 4、8 或 16 字节的 Paxos 值。没有填充，span<PxBytes<N>> 每个值占 N 字节。
+	// 需要使用二进制稠密类型，见 PaxosParam::defaultDenseType。
+	template<u64 N>
+	struct PxBytes
+	{
+		std::array<u8, N> mData;
+
+		PxBytes operator^(const PxBytes& o) const
+		{
+			PxBytes r;
+			for (u64 i = 0; i < N; ++i)
+				r.mData[i] = mData[i] ^ o.mData[i];
+			return r;
+		}
+
+		PxBytes operator&(const PxBytes& o) const
+		{
+			PxBytes r;
+			for (u64 i = 0; i < N; ++i)
+				r.mData[i] = mData[i] & o.mData[i];
+			return r;
+		}
+
+		bool operator==(const PxBytes& o) const { return mData == o.mData; }
+		bool operator!=(const PxBytes& o) const { return mData != o.mData; }
+	};
+
 	// A Paxos vector type when the elements are of type T.
 	// This differs from PxMatrix which has elements that 
 	// each a vector of type T's. PxVector are more efficient
@@ -574,6 +740,11 @@ namespace volePSI
 			using mut_value_type = std::remove_const_t<value_type>;
 			using mut_iterator = mut_value_type*;
 
+			// multAdd with a GF128 scalar, and so the GF128 dense type, is only
+			// implemented for block values.
+			// 只有 block 值实现了与 GF128 标量的 multAdd，因此只有 block 值可以使用 GF128 稠密类型。
+			static constexpr bool hasGf128 = std::is_same<block, mut_value_type>::value;
+
 			// internal mask used to multiply a value with a bit. 
 			// Assumes the zero bit string is the zero element.
 			// 用于将值与位相乘的内部掩码。假设零位字符串是零元素。
@@ -760,6 +931,10 @@ namespace volePSI
 			// 我们应该有的列数。
 			u64 mCols = 0;
 
+			// see PxVector::Helper::hasGf128.
+			// 见 PxVector::Helper::hasGf128。
+			static constexpr bool hasGf128 = std::is_same<block, mut_value_type>::value;
+
 			// internal mask used to multiply a value with a bit. 
 			// Assumes the zero bit string is the zero element.
 			// 用于将值与位相乘的内部掩码。假设零位字符串是零元素。
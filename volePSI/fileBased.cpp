@@ -1,6 +1,22 @@
 #include "fileBased.h"
+#include "Dedup.h"
 #include "cryptoTools/Crypto/RandomOracle.h"
 #include "coproto/Socket/AsioSocket.h"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <utility>
+
+#ifdef ENABLE_SSE
+#include <immintrin.h>
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace volePSI
 {
@@ -33,60 +49,246 @@ namespace volePSI
     block hexToBlock(const std::string& buff)
     {
         assert(buff.size() == 32);
+        block ret;
+        if (parseHexBlock(buff.data(), ret) == false)
+            throw std::runtime_error("not a hex block: " + buff);
+        return ret;
+    }
 
-        std::array<u8, 16> vv;
-        char b[3];
-        b[2] = 0;
+    namespace
+    {
+#ifndef ENABLE_SSE
+        // value of each hex digit, 0xff for other chars
+        struct HexTable
+        {
+            std::array<u8, 256> mVal;
+            HexTable()
+            {
+                mVal.fill(0xff);
+                for (u8 i = 0; i < 10; ++i)
+                    mVal['0' + i] = i;
+                for (u8 i = 0; i < 6; ++i)
+                    mVal['a' + i] = mVal['A' + i] = 10 + i;
+            }
+        };
+        const HexTable hexTable;
+#else
+        // 16 hex chars to 8 bytes in the low half, the first pair in byte 0.
+        // The bit of valid for each non hex char is cleared.
+        inline __m128i parseHex16(const char* hex, int& valid)
+        {
+            auto v = _mm_loadu_si128((const __m128i*)hex);
+            auto lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+
+            auto isDigit = _mm_and_si128(
+                _mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+            auto isAlpha = _mm_and_si128(
+                _mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+            valid &= _mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha));
+
+            auto nibbles = _mm_or_si128(
+                _mm_and_si128(isDigit, _mm_sub_epi8(v, _mm_set1_epi8('0'))),
+                _mm_and_si128(isAlpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
 
+            // each pair (hi, lo) to hi * 16 + lo
+            auto pairs = _mm_maddubs_epi16(nibbles, _mm_set1_epi16(0x0110));
+            return _mm_packus_epi16(pairs, pairs);
+        }
+#endif
+    }
+
+    bool parseHexBlock(const char* hex, block& out)
+    {
+#ifdef ENABLE_SSE
+        int valid = 0xffff;
+        auto lo = parseHex16(hex, valid);
+        auto hi = parseHex16(hex + 16, valid);
+
+        // bytes in text order, reversed so that the first pair is the most significant byte
+        auto bytes = _mm_unpacklo_epi64(lo, hi);
+        auto reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        out = block(_mm_shuffle_epi8(bytes, reverse));
+        return valid == 0xffff;
+#else
+        std::array<u8, 16> vv;
+        u8 bad = 0;
         for (u64 i = 0; i < 16; ++i)
         {
-            b[0] = buff[2 * i + 0];
-            b[1] = buff[2 * i + 1];
-            vv[15 - i] = (char)strtol(b, nullptr, 16);;
+            auto h = hexTable.mVal[(u8)hex[2 * i + 0]];
+            auto l = hexTable.mVal[(u8)hex[2 * i + 1]];
+            bad |= (h | l) & 0xf0;
+            vv[15 - i] = (h << 4) | (l & 0xf);
         }
-        return oc::toBlock(vv.data());
+        out = oc::toBlock(vv.data());
+        return bad == 0;
+#endif
     }
 
-    std::vector<block> readSet(const std::string& path, FileType ft, bool debug)
+    MappedFile::MappedFile(const std::string& path)
+    {
+#ifndef _WIN32
+        auto fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("failed to open file: " + path);
+        struct stat st;
+        if (::fstat(fd, &st))
+        {
+            ::close(fd);
+            throw std::runtime_error("failed to stat file: " + path);
+        }
+        mSize = st.st_size;
+        if (mSize)
+        {
+            auto ptr = ::mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr == MAP_FAILED)
+            {
+                ::close(fd);
+                throw std::runtime_error("failed to map file: " + path);
+            }
+            // the file is parsed front to back
+            ::madvise(ptr, mSize, MADV_SEQUENTIAL);
+            mData = (const char*)ptr;
+            mMapped = true;
+        }
+        ::close(fd);
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::in);
+        if (file.is_open() == false)
+            throw std::runtime_error("failed to open file: " + path);
+        mSize = filesize(file);
+        mBuffer.resize(mSize);
+        file.read(mBuffer.data(), mSize);
+        mData = mBuffer.data();
+#endif
+    }
+
+    MappedFile::MappedFile(MappedFile&& o) noexcept
+    {
+        *this = std::move(o);
+    }
+
+    MappedFile& MappedFile::operator=(MappedFile&& o) noexcept
+    {
+        release();
+        mData = std::exchange(o.mData, nullptr);
+        mSize = std::exchange(o.mSize, 0);
+        mMapped = std::exchange(o.mMapped, false);
+        mBuffer = std::move(o.mBuffer);
+        return *this;
+    }
+
+    MappedFile::~MappedFile()
+    {
+        release();
+    }
+
+    void MappedFile::release()
+    {
+#ifndef _WIN32
+        if (mMapped)
+            ::munmap((void*)mData, mSize);
+#endif
+        mData = nullptr;
+        mSize = 0;
+        mMapped = false;
+        mBuffer.clear();
+    }
+
+    span<const block> binarySetView(const MappedFile& file)
+    {
+        if (file.size() % 16)
+            throw std::runtime_error("Bad file size. Expecting a binary file with 16 byte elements");
+        return { (const block*)file.data().data(), file.size() / 16 };
+    }
+
+    void lineToBlock(span<const char> line, oc::RandomOracle& hash, block& out)
+    {
+        // if the input is already a 32 char hex 
+        // value, just parse it as is.
+        if (line.size() != 32 || parseHexBlock(line.data(), out) == false)
+        {
+            hash.Reset();
+            hash.Update(line.data(), line.size());
+            hash.Final(out);
+        }
+    }
+
+    u64 countLines(span<const char> text)
+    {
+        auto n = (u64)std::count(text.begin(), text.end(), '\n');
+        // the last line may not end with a newline
+        if (text.size() && text.back() != '\n')
+            ++n;
+        return n;
+    }
+
+    u64 numTextThreads(u64 numThreads, u64 textSize)
+    {
+        if (numThreads == 0)
+            numThreads = std::max<u64>(1, std::thread::hardware_concurrency());
+        // small files are not worth the threads
+        return std::max<u64>(1, std::min<u64>(numThreads, textSize / (1 << 20)));
+    }
+
+    std::vector<span<const char>> splitLines(span<const char> text, u64 numChunks)
+    {
+        std::vector<u64> begin(numChunks + 1, text.size());
+        begin[0] = 0;
+        for (u64 t = 1; t < numChunks; ++t)
+        {
+            auto b = std::max(begin[t - 1], text.size() * t / numChunks);
+            if (b > 0 && b < text.size())
+            {
+                auto nl = (const char*)std::memchr(text.data() + b - 1, '\n', text.size() - b + 1);
+                b = nl ? nl - text.data() + 1 : text.size();
+            }
+            begin[t] = b;
+        }
+
+        std::vector<span<const char>> chunks(numChunks);
+        for (u64 t = 0; t < numChunks; ++t)
+            chunks[t] = text.subspan(begin[t], begin[t + 1] - begin[t]);
+        return chunks;
+    }
+
+    std::vector<block> readSet(const std::string& path, FileType ft, bool debug, u64 numThreads)
     {
         std::vector<block> ret;
         if (ft == FileType::Bin)
         {
-            std::ifstream file(path, std::ios::binary | std::ios::in);
-            if (file.is_open() == false)
-                throw std::runtime_error("failed to open file: " + path);
-            auto size = filesize(file);
-            if (size % 16)
-                throw std::runtime_error("Bad file size. Expecting a binary file with 16 byte elements");
-
-            ret.resize(size / 16);
-            file.read((char*)ret.data(), size);
+            MappedFile file(path);
+            auto view = binarySetView(file);
+            ret.assign(view.begin(), view.end());
         }
         else if (ft == FileType::Csv)
         {
-            // we will use this to hash large inputs
-            oc::RandomOracle hash(sizeof(block));
-
-            std::ifstream file(path, std::ios::in);
-            if (file.is_open() == false)
-                throw std::runtime_error("failed to open file: " + path);
-            std::string buffer;
-            while (std::getline(file, buffer))
-            {
-                // if the input is already a 32 char hex 
-                // value, just parse it as is.
-                if (isHexBlock(buffer))
-                {
-                    ret.push_back(hexToBlock(buffer));
-                }
-                else
+            MappedFile file(path);
+            numThreads = numTextThreads(numThreads, file.size());
+            auto chunks = splitLines(file.data(), numThreads);
+
+            // count the lines of each chunk, then parse them into their place
+            std::vector<u64> offset(numThreads + 1);
+            parallelFor(numThreads, [&](u64 t) { offset[t + 1] = countLines(chunks[t]); });
+            for (u64 t = 0; t < numThreads; ++t)
+                offset[t + 1] += offset[t];
+
+            ret.resize(offset.back());
+            parallelFor(numThreads, [&](u64 t) {
+                // we will use this to hash large inputs
+                oc::RandomOracle hash(sizeof(block));
+                auto iter = chunks[t].data();
+                auto end = iter + chunks[t].size();
+                for (u64 i = offset[t]; i < offset[t + 1]; ++i)
                 {
-                    ret.emplace_back();
-                    hash.Reset();
-                    hash.Update(buffer.data(), buffer.size());
-                    hash.Final(ret.back());
+                    auto next = (const char*)std::memchr(iter, '\n', end - iter);
+                    if (next == nullptr)
+                        next = end;
+                    lineToBlock({ iter, next }, hash, ret[i]);
+                    iter = next + 1;
                 }
-            }
+            });
         }
         else
         {
@@ -95,23 +297,11 @@ namespace volePSI
 
         if (debug)
         {
-            u64 maxPrint = 40;
-            std::unordered_map<block, u64> hashes;
-            for (u64 i = 0; i < ret.size(); ++i)
-            {
-                auto r = hashes.insert({ ret[i], i });
-                if (r.second == false)
-                {
-                    std::cout << "duplicate at index " << i << " & " << r.first->second << std::endl;
-                    --maxPrint;
-
-                    if (!maxPrint)
-                        break;
-                }
-            }
-
+            auto duplicates = findDuplicateKeys(ret, numThreads);
+            for (u64 i = 0; i < std::min<u64>(40, duplicates.size()); ++i)
+                std::cout << "duplicate at index " << duplicates[i].mSecond << " & " << duplicates[i].mFirst << std::endl;
 
-            if (maxPrint != 40)
+            if (duplicates.size())
                 throw RTE_LOC;
         }
 
@@ -136,6 +326,9 @@ namespace volePSI
         }
     }
 
+    // size of the writes of writeOutput
+    static const u64 outputBufferSize = 1 << 20;
+
     void writeOutput(std::string outPath, FileType ft, const std::vector<u64>& intersection, bool indexOnly, std::string inPath)
     {
         std::ofstream file;
@@ -163,65 +356,61 @@ namespace volePSI
         }
         else
         {
-            //std::set<u64> set(intersection.begin(), intersection.end());
-            if (ft == FileType::Bin)
-            {
-                std::ifstream inFile(inPath, std::ios::binary | std::ios::in);
-                if (inFile.is_open() == false)
-                    throw std::runtime_error("failed to open file: " + inPath);
-                auto size = filesize(inFile);
-                if (size % 16)
-                    throw std::runtime_error("Bad file size. Expecting a binary file with 16 byte elements");
-
-                auto n = size / 16;
-                std::vector<block> fData(n);
-                inFile.read((char*)fData.data(), size);
-                for (u64 i = 0; i < intersection.size(); ++i)
+            // Records are written in file order: the input is scanned once
+            // and the matching records are collected into a large buffer.
+            auto sorted = intersection;
+            std::sort(sorted.begin(), sorted.end());
+
+            MappedFile inFile(inPath);
+            std::vector<char> buffer;
+            buffer.reserve(outputBufferSize + 1024);
+            auto append = [&](const char* data, u64 size) {
+                buffer.insert(buffer.end(), data, data + size);
+                if (buffer.size() >= outputBufferSize)
                 {
-                    file.write((char*)fData[intersection[i]].data(), sizeof(block));
+                    file.write(buffer.data(), buffer.size());
+                    buffer.clear();
                 }
+            };
 
+            if (ft == FileType::Bin)
+            {
+                auto set = binarySetView(inFile);
+                if (sorted.size() && sorted.back() >= set.size())
+                    throw std::runtime_error("intersection index out of range of the input file: " + inPath);
+
+                for (auto i : sorted)
+                    append((const char*)&set[i], sizeof(block));
             }
             else if (ft == FileType::Csv)
             {
-                // we will use this to hash large inputs
-                oc::RandomOracle hash(sizeof(block));
-
-                std::ifstream inFile(inPath, std::ios::in);
-                if (inFile.is_open() == false)
-                    throw std::runtime_error("failed to open file: " + inPath);
-
-                u64 size = filesize(inFile);
-                std::vector<char> fData(size);
-                inFile.read(fData.data(), size);
-
-
-                std::vector<span<char>> beg;
-                auto iter = fData.begin();
-                for (u64 i = 0; i < size; ++i)
+                auto text = inFile.data();
+                auto iter = text.data();
+                auto end = text.data() + text.size();
+                u64 line = 0;
+                for (auto i : sorted)
                 {
-                    if (fData[i] == '\n')
+                    // skip to line i
+                    for (; line < i && iter < end; ++line)
                     {
-                        beg.push_back(span<char>(iter, fData.begin() + i));
-                        iter = fData.begin() + i + 1;
-                        assert(beg.back().size());
+                        auto nl = (const char*)std::memchr(iter, '\n', end - iter);
+                        iter = nl ? nl + 1 : end;
                     }
-                }
-
-                if (iter != fData.end())
-                    beg.push_back(span<char>(iter, fData.end()));
+                    if (iter == end)
+                        throw std::runtime_error("intersection index out of range of the input file: " + inPath);
 
-                for (u64 i = 0; i < intersection.size(); ++i)
-                {
-                    auto w = beg[intersection[i]];
-                    file.write(w.data(), w.size());
-                    file << '\n';
+                    auto nl = (const char*)std::memchr(iter, '\n', end - iter);
+                    auto next = nl ? nl : end;
+                    append(iter, next - iter);
+                    append("\n", 1);
                 }
             }
             else
             {
                 throw std::runtime_error("unknown file type");
             }
+
+            file.write(buffer.data(), buffer.size());
         }
     }
 }
\ No newline at end of file
@@ -13,6 +13,9 @@
 #include <assert.h>
 #include "Defines.h"
 #include "cryptoTools/Common/CLP.h"
+#include "cryptoTools/Crypto/RandomOracle.h"
+#include <exception>
+#include <thread>
 
 namespace volePSI
 {
@@ -25,6 +28,34 @@ namespace volePSI
 	bool isHexBlock(const std::string& buff);
 	block hexToBlock(const std::string& buff);
 
+	// Parses 32 hex chars, most significant byte first, into out. Returns false
+	// if one of them is not a hex digit. Uses SSE when enabled.
+	bool parseHexBlock(const char* hex, block& out);
+
+	// A read only view of a whole file. The file is memory mapped where
+	// supported and read into memory otherwise.
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+		MappedFile(const std::string& path);
+		MappedFile(const MappedFile&) = delete;
+		MappedFile(MappedFile&& o) noexcept;
+		MappedFile& operator=(MappedFile&& o) noexcept;
+		~MappedFile();
+
+		span<const char> data() const { return { mData, mSize }; }
+		u64 size() const { return mSize; }
+
+	private:
+		const char* mData = nullptr;
+		u64 mSize = 0;
+		bool mMapped = false;
+		std::vector<char> mBuffer;
+
+		void release();
+	};
+
 	enum class FileType
 	{
 		Bin,
@@ -38,7 +69,50 @@ namespace volePSI
 		Invalid
 	};
 
-	std::vector<block> readSet(const std::string& path, FileType ft, bool debug);
+	// Reads the set, one element per line for csv files or per 16 bytes for
+	// binary files. Lines that are 32 hex chars are parsed, others are hashed.
+	// Csv files are split into chunks on line boundaries and parsed by
+	// numThreads threads, 0 for one per core.
+	std::vector<block> readSet(const std::string& path, FileType ft, bool debug, u64 numThreads = 0);
+
+	// Zero copy view of a binary set file, valid while file is alive.
+	span<const block> binarySetView(const MappedFile& file);
+
+	// The element of a csv line: 32 hex chars are parsed, anything else is
+	// hashed with hash, a RandomOracle with a 16 byte output.
+	void lineToBlock(span<const char> line, oc::RandomOracle& hash, block& out);
+
+	// The number of lines, the last one may not end with a newline.
+	u64 countLines(span<const char> text);
+
+	// The threads used to parse textSize bytes, at most numThreads (0 for one
+	// per core) and at most one per MiB.
+	u64 numTextThreads(u64 numThreads, u64 textSize);
+
+	// Splits text into numChunks chunks that start at the beginning of a line.
+	std::vector<span<const char>> splitLines(span<const char> text, u64 numChunks);
+
+	// Calls f(t) for t in [0, numThreads), each on its own thread. The first
+	// exception thrown by f is rethrown once all threads are done.
+	template<typename F>
+	void parallelFor(u64 numThreads, F&& f)
+	{
+		std::vector<std::exception_ptr> errors(numThreads);
+		auto run = [&](u64 t) {
+			try { f(t); }
+			catch (...) { errors[t] = std::current_exception(); }
+		};
+		std::vector<std::thread> thrds;
+		for (u64 t = 1; t < numThreads; ++t)
+			thrds.emplace_back(run, t);
+		if (numThreads)
+			run(0);
+		for (auto& thrd : thrds)
+			thrd.join();
+		for (auto& e : errors)
+			if (e)
+				std::rethrow_exception(e);
+	}
 
 	// void doFilePSI(const oc::CLP& cmd);
 